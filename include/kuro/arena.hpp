@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <memory_resource>
+
+namespace kuro
+{
+
+class arena
+{
+public:
+    explicit arena(std::size_t initial_size = 4096) : m_resource(initial_size) {}
+    arena(const arena&) = delete;
+    arena& operator=(const arena&) = delete;
+
+    void* allocate(std::size_t size, std::size_t alignment = alignof(std::max_align_t))
+    {
+        m_used += size;
+        return m_resource.allocate(size, alignment);
+    }
+    template <typename T>
+    T* allocate_array(std::size_t n)
+    {
+        return static_cast<T*>(allocate(n * sizeof(T), alignof(T)));
+    }
+    std::pmr::memory_resource* resource() noexcept
+    {
+        return &m_resource;
+    }
+    std::size_t used() const noexcept
+    {
+        return m_used;
+    }
+    void release()
+    {
+        m_resource.release();
+        m_used = 0;
+    }
+
+private:
+    std::pmr::monotonic_buffer_resource m_resource;
+    std::size_t m_used = 0;
+};
+
+}
\ No newline at end of file
@@ -1,6 +1,11 @@
 #pragma once
 
+#include <atomic>
+#include <memory>
+#include <mutex>
+
 #include "continuation.hpp"
+#include "event_loop.hpp"
 
 namespace kuro
 {
@@ -8,14 +13,65 @@ namespace kuro
 class cancellation
 {
 public:
+    cancellation() = default;
+    cancellation(const cancellation&) = delete;
+    cancellation& operator=(const cancellation&) = delete;
+    ~cancellation()
+    {
+        if (m_shared) {
+            std::lock_guard lock(m_shared->mutex);
+            m_shared->self = nullptr;
+        }
+        if (m_parent) {
+            m_parent->remove_waiter(m_parent_link);
+        }
+    }
+
+    // Triggered with this one; must be destroyed before it.
+    cancellation child()
+    {
+        return cancellation(child_tag{}, *this);
+    }
+
     void trigger()
     {
-        m_set = true;
-        m_continuation.resume_all();
+        m_set.store(true);
+        auto loop = m_loop.load();
+        if (!loop) {
+            return;
+        }
+
+        if (loop->is_current()) {
+            wake_subtree(this);
+        } else {
+            loop->post([shared = m_shared] {
+                std::lock_guard lock(shared->mutex);
+                if (shared->self) {
+                    wake_subtree(shared->self);
+                }
+            });
+        }
     }
     bool is_set() const
     {
-        return m_set;
+        return m_set.load();
+    }
+
+    // Calls node.notify, or schedules node.handle, once triggered.
+    void add_waiter(detail::waiter_node& node)
+    {
+        m_waiters.push(node);
+        if (!m_shared) {
+            m_shared = std::make_shared<shared_state>(this);
+        }
+        m_loop.store(&event_loop::current());
+        if (is_set()) {
+            wake_subtree(this);
+        }
+    }
+    bool remove_waiter(detail::waiter_node& node) noexcept
+    {
+        return m_waiters.erase(node);
     }
 
     auto wait()
@@ -29,26 +85,83 @@ public:
             }
             void await_suspend(std::coroutine_handle<> handle) noexcept
             {
-                m_handle = handle;
-                m_cancel->m_continuation.push(handle);
+                m_waiter.handle = handle;
+                m_cancel->add_waiter(m_waiter);
             }
             void await_resume() const noexcept {}
             void await_cancel() noexcept
             {
-                m_cancel->m_continuation.erase(m_handle);
+                if (!m_cancel->remove_waiter(m_waiter)) {
+                    m_waiter.unschedule();
+                }
             }
         
         private:
             cancellation* m_cancel;
-            std::coroutine_handle<> m_handle;
+            detail::waiter_node m_waiter;
         };
 
         return awaitable{this};
     }
 
 private:
-    multi_continuation m_continuation;
-    bool m_set = false;
+    struct child_tag {};
+
+    // Outlives the cancellation for callbacks posted by trigger.
+    struct shared_state
+    {
+        explicit shared_state(cancellation* c) : self(c) {}
+        std::mutex mutex;
+        cancellation* self;
+    };
+
+    struct parent_link : detail::waiter_node
+    {
+        cancellation* self = nullptr;
+    };
+
+    cancellation(child_tag, cancellation& parent) : m_parent(&parent)
+    {
+        m_parent_link.self = this;
+        m_parent_link.notify = on_parent_triggered;
+        parent.add_waiter(m_parent_link);
+    }
+
+    static void on_parent_triggered(detail::waiter_node& node)
+    {
+        wake_subtree(static_cast<parent_link&>(node).self);
+    }
+
+    // Iterative, with the triggered children on an intrusive stack.
+    static void wake_subtree(cancellation* root)
+    {
+        root->m_next_triggered = nullptr;
+        for (auto stack = root; stack; ) {
+            auto c = stack;
+            stack = c->m_next_triggered;
+            while (auto node = c->m_waiters.pop()) {
+                if (node->notify == on_parent_triggered) {
+                    auto child = static_cast<parent_link*>(node)->self;
+                    if (!child->m_set.exchange(true)) {
+                        child->m_next_triggered = stack;
+                        stack = child;
+                    }
+                } else if (node->notify) {
+                    node->notify(*node);
+                } else {
+                    node->schedule();
+                }
+            }
+        }
+    }
+
+    intrusive_continuation m_waiters;
+    std::atomic<bool> m_set = false;
+    std::atomic<event_loop*> m_loop = nullptr;
+    std::shared_ptr<shared_state> m_shared;
+    cancellation* m_parent = nullptr;
+    parent_link m_parent_link;
+    cancellation* m_next_triggered = nullptr;
 };
 
 }
\ No newline at end of file
@@ -0,0 +1,255 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <concepts>
+#include <coroutine>
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <utility>
+
+#include "continuation.hpp"
+#include "queuelike.hpp"
+
+namespace kuro
+{
+
+namespace detail
+{
+
+// A FIFO stored in a single power-of-two sized array, indexed by
+// free-running head and tail counters. The caller keeps it from overflowing,
+// since a push past the capacity would overwrite the oldest item.
+template <typename T>
+class ring_buffer
+{
+public:
+    using value_type = T;
+
+    ring_buffer(std::size_t capacity, std::pmr::memory_resource* resource) :
+        m_alloc(resource),
+        m_mask(std::bit_ceil(std::max<std::size_t>(capacity, 1)) - 1),
+        m_items(m_alloc.allocate(m_mask + 1)) {}
+    ring_buffer(const ring_buffer&) = delete;
+    ring_buffer& operator=(const ring_buffer&) = delete;
+    ~ring_buffer()
+    {
+        while (!empty()) {
+            pop();
+        }
+        m_alloc.deallocate(m_items, m_mask + 1);
+    }
+
+    std::size_t size() const noexcept
+    {
+        return m_tail - m_head;
+    }
+    bool empty() const noexcept
+    {
+        return m_head == m_tail;
+    }
+    T& front() noexcept
+    {
+        return m_items[m_head & m_mask];
+    }
+    template <typename U>
+    void push(U&& value)
+    {
+        assert(size() <= m_mask);
+        std::construct_at(&m_items[m_tail & m_mask], std::forward<U>(value));
+        ++m_tail;
+    }
+    void pop() noexcept
+    {
+        std::destroy_at(&m_items[m_head & m_mask]);
+        ++m_head;
+    }
+
+private:
+    std::pmr::polymorphic_allocator<T> m_alloc;
+    std::size_t m_mask;
+    T* m_items;
+    std::size_t m_head = 0;
+    std::size_t m_tail = 0;
+};
+
+}
+
+// A bounded FIFO channel: a queuelike over a ring_buffer, which adds waiting
+// for a free slot on push, with the same reservations as on pop, and close().
+// The base is private, as its push() doesn't check the capacity.
+template <std::movable T, continuation_container Continuation = intrusive_continuation>
+class channel : queuelike<detail::ring_buffer<T>, Continuation>
+{
+    using base = queuelike<detail::ring_buffer<T>, Continuation>;
+
+public:
+    using base::empty;
+
+    explicit channel(std::size_t capacity, std::pmr::memory_resource* resource = std::pmr::get_default_resource()) :
+        base(std::in_place, resource, capacity),
+        m_pushers(base::make_continuation(resource)),
+        m_capacity(std::max<std::size_t>(capacity, 1)) {}
+
+    bool try_push(const T& value)
+    {
+        return try_emplace(value);
+    }
+    bool try_push(T&& value)
+    {
+        return try_emplace(std::move(value));
+    }
+    std::optional<T> try_pop()
+    {
+        if (this->empty()) {
+            return std::nullopt;
+        }
+        return take();
+    }
+
+    auto push(T value)
+    {
+        struct push_operation
+        {
+            push_operation(channel* c, T&& value) : m_channel(c), m_value(std::move(value)) {}
+            bool await_ready() const noexcept
+            {
+                return m_channel->m_closed || !m_channel->full();
+            }
+            void await_suspend(std::coroutine_handle<> handle) noexcept
+            {
+                m_waiter.handle = handle;
+                detail::push_waiter(m_channel->m_pushers, m_waiter);
+            }
+            bool await_resume()
+            {
+                if (m_waiter.handle) {
+                    m_channel->m_reserved_slots--;
+                }
+                if (m_channel->m_closed) {
+                    return false;
+                }
+
+                m_channel->m_queue.push(std::move(m_value));
+                m_channel->wake_one();
+                return true;
+            }
+            void await_cancel() noexcept
+            {
+                if (!detail::erase_waiter(m_channel->m_pushers, m_waiter)) {
+                    m_waiter.unschedule();
+                    m_channel->m_reserved_slots--;
+                    m_channel->wake_pusher();
+                }
+            }
+
+        private:
+            channel* m_channel;
+            T m_value;
+            detail::waiter_node m_waiter;
+        };
+
+        return push_operation{this, std::move(value)};
+    }
+    auto pop()
+    {
+        struct pop_operation : base::pop_operation
+        {
+            using base::pop_operation::pop_operation;
+            bool await_ready() const noexcept
+            {
+                return self()->m_closed || !self()->empty();
+            }
+            // A pop woken by close() has no item reserved, but runs after
+            // the ones that do.
+            std::optional<T> await_resume()
+            {
+                if (this->m_waiter.handle) {
+                    self()->m_reserved--;
+                    if (self()->m_queue.empty()) {
+                        return std::nullopt;
+                    }
+                } else if (self()->empty()) {
+                    return std::nullopt;
+                }
+                return self()->take();
+            }
+
+        private:
+            channel* self() const noexcept
+            {
+                return static_cast<channel*>(this->m_queuelike);
+            }
+        };
+
+        return pop_operation{this};
+    }
+
+    // Pending and later pushes fail, and pops fail once the remaining items
+    // have been taken. Woken waiters are counted as reserved, like the
+    // ones woken for an item or a slot.
+    void close()
+    {
+        m_closed = true;
+        while (m_pushers.resume_one()) {
+            m_reserved_slots++;
+        }
+        while (this->m_continuation.resume_one()) {
+            this->m_reserved++;
+        }
+    }
+    bool closed() const noexcept
+    {
+        return m_closed;
+    }
+
+    std::size_t capacity() const noexcept
+    {
+        return m_capacity;
+    }
+    // Items reserved for woken poppers count neither here nor in empty(),
+    // while slots reserved for woken pushers count towards full().
+    std::size_t size() const noexcept
+    {
+        return this->empty() ? 0 : this->m_queue.size() - this->m_reserved;
+    }
+    bool full() const noexcept
+    {
+        return this->m_queue.size() + m_reserved_slots >= m_capacity;
+    }
+
+private:
+    template <typename U>
+    bool try_emplace(U&& value)
+    {
+        if (m_closed || full()) {
+            return false;
+        }
+
+        this->m_queue.push(std::forward<U>(value));
+        this->wake_one();
+        return true;
+    }
+    T take()
+    {
+        T value = base::take();
+        wake_pusher();
+        return value;
+    }
+    void wake_pusher()
+    {
+        if (!m_closed && !full() && m_pushers.resume_one()) {
+            m_reserved_slots++;
+        }
+    }
+
+    Continuation m_pushers;
+    std::size_t m_capacity;
+    std::size_t m_reserved_slots = 0;
+    bool m_closed = false;
+};
+
+}
\ No newline at end of file
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <type_traits>
+#include <vector>
+
+namespace kuro::detail
+{
+
+// Chase-Lev deque: push and pop by the owning thread, steal by any thread.
+template <typename T>
+class chase_lev_deque
+{
+    static_assert(std::is_trivially_copyable_v<T>);
+
+    class buffer
+    {
+    public:
+        buffer(std::int64_t capacity) : m_mask(capacity - 1), m_items(new std::atomic<T>[capacity]) {}
+
+        std::int64_t capacity() const noexcept
+        {
+            return m_mask + 1;
+        }
+        T get(std::int64_t i) const noexcept
+        {
+            return m_items[i & m_mask].load(std::memory_order_relaxed);
+        }
+        void put(std::int64_t i, T item) noexcept
+        {
+            m_items[i & m_mask].store(item, std::memory_order_relaxed);
+        }
+
+    private:
+        std::int64_t m_mask;
+        std::unique_ptr<std::atomic<T>[]> m_items;
+    };
+
+public:
+    chase_lev_deque(std::int64_t capacity = 256)
+    {
+        m_buffers.push_back(std::make_unique<buffer>(capacity));
+        m_buffer.store(m_buffers.back().get(), std::memory_order_relaxed);
+    }
+    chase_lev_deque(const chase_lev_deque&) = delete;
+    chase_lev_deque& operator=(const chase_lev_deque&) = delete;
+
+    void push(T item)
+    {
+        auto b = m_bottom.load(std::memory_order_relaxed);
+        auto t = m_top.load(std::memory_order_acquire);
+        auto a = m_buffer.load(std::memory_order_relaxed);
+        if (b - t > a->capacity() - 1) {
+            a = grow(a, t, b);
+        }
+        a->put(b, item);
+        m_bottom.store(b + 1, std::memory_order_release);
+    }
+
+    std::optional<T> pop()
+    {
+        auto b = m_bottom.load(std::memory_order_relaxed) - 1;
+        auto a = m_buffer.load(std::memory_order_relaxed);
+        m_bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto t = m_top.load(std::memory_order_relaxed);
+
+        std::optional<T> item;
+        if (t <= b) {
+            item = a->get(b);
+            if (t == b) {
+                if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                    item.reset();
+                }
+                m_bottom.store(b + 1, std::memory_order_relaxed);
+            }
+        } else {
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return item;
+    }
+
+    std::optional<T> steal()
+    {
+        auto t = m_top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto b = m_bottom.load(std::memory_order_acquire);
+        if (t >= b) {
+            return std::nullopt;
+        }
+
+        auto item = m_buffer.load(std::memory_order_acquire)->get(t);
+        if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            return std::nullopt;
+        }
+        return item;
+    }
+
+    bool empty() const noexcept
+    {
+        return m_top.load(std::memory_order_relaxed) >= m_bottom.load(std::memory_order_relaxed);
+    }
+
+private:
+    buffer* grow(buffer* old, std::int64_t top, std::int64_t bottom)
+    {
+        // Thieves may still read the old buffer, so it lives as long as the deque.
+        auto bigger = std::make_unique<buffer>(2 * old->capacity());
+        for (auto i = top; i < bottom; ++i) {
+            bigger->put(i, old->get(i));
+        }
+        m_buffers.push_back(std::move(bigger));
+        m_buffer.store(m_buffers.back().get(), std::memory_order_release);
+        return m_buffers.back().get();
+    }
+
+    alignas(64) std::atomic<std::int64_t> m_top{0};
+    alignas(64) std::atomic<std::int64_t> m_bottom{0};
+    std::atomic<buffer*> m_buffer;
+    std::vector<std::unique_ptr<buffer>> m_buffers;
+};
+
+}
\ No newline at end of file
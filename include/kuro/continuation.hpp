@@ -1,24 +1,108 @@
 #pragma once
 
 #include <coroutine>
+#include <deque>
+#include <memory_resource>
 #include <optional>
-#include <vector>
+#include <utility>
+
+#include "ready_queue.hpp"
 
 namespace kuro
 {
 
+class intrusive_continuation;
+
+namespace detail
+{
+
+// A waiter embedded in an awaitable. Copies start out unlinked, since an
+// awaitable is only linked into a container from within await_suspend.
+// Waking a node schedules its handle, or calls notify instead if it is set.
+class waiter_node
+{
+    friend intrusive_continuation;
+
+public:
+    using notify_t = void (*)(waiter_node&);
+
+    waiter_node() = default;
+    waiter_node(const waiter_node&) noexcept {}
+    waiter_node& operator=(const waiter_node&) noexcept
+    {
+        return *this;
+    }
+
+    // Schedules handle, keeping the ready queue ticket for unschedule().
+    void schedule()
+    {
+        m_ticket = ready_queue::instance().push(handle);
+    }
+    // Takes a woken waiter back out of the ready queue, in O(1) unless it was
+    // woken by a container that only holds its handle.
+    bool unschedule()
+    {
+        auto& ready = ready_queue::instance();
+        return m_ticket ? ready.erase(std::exchange(m_ticket, 0)) : ready.erase(handle);
+    }
+
+    std::coroutine_handle<> handle;
+    notify_t notify = nullptr;
+
+private:
+    waiter_node* m_prev = nullptr;
+    waiter_node* m_next = nullptr;
+    bool m_linked = false;
+    ready_queue::ticket m_ticket = 0;
+};
+
+}
+
 template <typename T>
 concept continuation_container = requires (T a) {
-    { a.push(std::coroutine_handle<>{}) } -> std::same_as<void>;
-    { a.resume_one() } -> std::same_as<void>;
+    { a.resume_one() } -> std::same_as<bool>;
     { a.resume_all() } -> std::same_as<void>;
-    { a.erase(std::coroutine_handle<>{}) } -> std::same_as<void>;
-};
+} && (
+    requires (T a) {
+        { a.push(std::coroutine_handle<>{}) } -> std::same_as<void>;
+        { a.erase(std::coroutine_handle<>{}) } -> std::same_as<bool>;
+    } ||
+    requires (T a, detail::waiter_node& node) {
+        { a.push(node) } -> std::same_as<void>;
+        { a.erase(node) } -> std::same_as<bool>;
+    }
+);
+
+namespace detail
+{
+
+template <continuation_container Continuation>
+void push_waiter(Continuation& continuation, waiter_node& node)
+{
+    if constexpr (requires { continuation.push(node); }) {
+        continuation.push(node);
+    } else {
+        continuation.push(node.handle);
+    }
+}
+
+template <continuation_container Continuation>
+bool erase_waiter(Continuation& continuation, waiter_node& node)
+{
+    if constexpr (requires { continuation.erase(node); }) {
+        return continuation.erase(node);
+    } else {
+        return continuation.erase(node.handle);
+    }
+}
+
+}
 
 class multi_continuation
 {
 public:
     multi_continuation() = default;
+    explicit multi_continuation(std::pmr::memory_resource* resource) : m_continuations(resource) {}
     multi_continuation(const multi_continuation&) = delete;
     multi_continuation& operator=(const multi_continuation&) = delete;
 
@@ -26,35 +110,38 @@ public:
     {
         m_continuations.push_back(handle);
     }
-    void resume_one()
+    bool resume_one()
     {
-        if (!m_continuations.empty()) {
-            auto h = m_continuations.back();
-            m_continuations.pop_back();
-            h.resume();
+        if (m_continuations.empty()) {
+            return false;
         }
+
+        detail::ready_queue::instance().push(m_continuations.front());
+        m_continuations.pop_front();
+        return true;
     }
     void resume_all()
     {
-        while (!m_continuations.empty()) {
-            auto h = m_continuations.back();
-            m_continuations.pop_back();
-            h.resume();
+        auto& ready = detail::ready_queue::instance();
+        for (auto handle : m_continuations) {
+            ready.push(handle);
         }
+        m_continuations.clear();
     }
 
-    void erase(std::coroutine_handle<> handle)
+    bool erase(std::coroutine_handle<> handle)
     {
         for (auto i = 0UL; i < m_continuations.size(); ++i) {
             if (m_continuations[i].address() == handle.address()) {
                 m_continuations.erase(m_continuations.begin() + i);
-                return;
+                return true;
             }
         }
+        return false;
     }
 
 private:
-    std::vector<std::coroutine_handle<>> m_continuations;
+    std::pmr::deque<std::coroutine_handle<>> m_continuations;
 };
 
 class single_continuation
@@ -68,28 +155,120 @@ public:
     {
         m_continuation = handle;
     }
-    void resume_one()
+    bool resume_one()
     {
-        if (m_continuation) {
-            auto h = *m_continuation;
-            m_continuation.reset();
-            h.resume();
+        if (!m_continuation) {
+            return false;
         }
+
+        detail::ready_queue::instance().push(*m_continuation);
+        m_continuation.reset();
+        return true;
     }
     void resume_all()
     {
         resume_one();
     }
 
-    void erase(std::coroutine_handle<> handle)
+    bool erase(std::coroutine_handle<> handle)
     {
         if (m_continuation && m_continuation->address() == handle.address()) {
             m_continuation.reset();
+            return true;
         }
+        return false;
     }
 
 private:
     std::optional<std::coroutine_handle<>> m_continuation;
 };
 
+class intrusive_continuation
+{
+public:
+    intrusive_continuation() = default;
+    intrusive_continuation(const intrusive_continuation&) = delete;
+    intrusive_continuation& operator=(const intrusive_continuation&) = delete;
+
+    void push(detail::waiter_node& node)
+    {
+        node.m_prev = m_tail;
+        node.m_next = nullptr;
+        node.m_linked = true;
+        if (m_tail) {
+            m_tail->m_next = &node;
+        } else {
+            m_head = &node;
+        }
+        m_tail = &node;
+    }
+    bool resume_one()
+    {
+        if (!m_head) {
+            return false;
+        }
+
+        wake(*m_head);
+        return true;
+    }
+    void resume_all()
+    {
+        while (m_head) {
+            wake(*m_head);
+        }
+    }
+    // Like resume_all(), but a lone waiter is returned instead, for a caller
+    // about to suspend to resume it by symmetric transfer.
+    std::coroutine_handle<> transfer_all()
+    {
+        if (m_head && m_head == m_tail && !m_head->notify) {
+            return pop()->handle;
+        }
+        resume_all();
+        return std::noop_coroutine();
+    }
+
+    bool erase(detail::waiter_node& node)
+    {
+        if (!node.m_linked) {
+            return false;
+        }
+        unlink(node);
+        return true;
+    }
+    bool empty() const noexcept
+    {
+        return m_head == nullptr;
+    }
+    detail::waiter_node* pop() noexcept
+    {
+        auto node = m_head;
+        if (node) {
+            unlink(*node);
+        }
+        return node;
+    }
+
+private:
+    void wake(detail::waiter_node& node)
+    {
+        unlink(node);
+        if (node.notify) {
+            node.notify(node);
+        } else {
+            node.schedule();
+        }
+    }
+    void unlink(detail::waiter_node& node) noexcept
+    {
+        (node.m_prev ? node.m_prev->m_next : m_head) = node.m_next;
+        (node.m_next ? node.m_next->m_prev : m_tail) = node.m_prev;
+        node.m_prev = node.m_next = nullptr;
+        node.m_linked = false;
+    }
+
+    detail::waiter_node* m_head = nullptr;
+    detail::waiter_node* m_tail = nullptr;
+};
+
 }
\ No newline at end of file
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <coroutine>
+#include <exception>
+#include <type_traits>
+#include <utility>
+
+#include "promise.hpp"
+#include "unique_coroutine_handle.hpp"
+
+namespace kuro
+{
+
+// Starts running as soon as it is called, and only suspends at its first real
+// suspension point. The frame is owned by the returned object and the handle
+// never escapes it, so the compiler may elide the allocation (HALO) when the
+// task is awaited in the calling coroutine.
+template <typename T>
+class eager_task
+{
+public:
+    class promise_type final : public detail::base_promise_t<T>
+    {
+    public:
+        eager_task<T> get_return_object() noexcept
+        {
+            return eager_task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_never initial_suspend() const noexcept { return {}; }
+        auto final_suspend() const noexcept
+        {
+            struct awaitable
+            {
+                bool await_ready() noexcept { return false; }
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept
+                {
+                    auto continuation = handle.promise().m_continuation;
+                    if (continuation) {
+                        return continuation;
+                    }
+
+                    return std::noop_coroutine();
+                }
+                void await_resume() noexcept {}
+            };
+            return awaitable{};
+        }
+        void set_continuation(std::coroutine_handle<> continuation)
+        {
+            m_continuation = continuation;
+        }
+
+    private:
+        std::coroutine_handle<> m_continuation;
+    };
+
+    T await_resume()
+    {
+        return m_handle.promise().result();
+    }
+    bool await_ready() const noexcept
+    {
+        return m_handle.done();
+    }
+    void await_suspend(std::coroutine_handle<> parent_handle) noexcept
+    {
+        m_handle.promise().set_continuation(parent_handle);
+    }
+    bool done() const noexcept
+    {
+        return m_handle.done();
+    }
+
+private:
+    eager_task(std::coroutine_handle<promise_type> handle) : m_handle(handle) {}
+
+    detail::unique_coroutine_handle<promise_type> m_handle;
+};
+
+}
\ No newline at end of file
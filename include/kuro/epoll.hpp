@@ -0,0 +1,132 @@
+#pragma once
+
+#include <algorithm>
+#include <coroutine>
+#include <memory_resource>
+#include <utility>
+#include <vector>
+
+#include <sys/epoll.h>
+
+#include "error.hpp"
+#include "ready_queue.hpp"
+#include "unique_fd.hpp"
+
+namespace kuro::detail
+{
+
+// Performed by the loop when its fd becomes ready, before the awaiter is
+// resumed. Returns false if the operation would still block, e.g. because
+// another reader of the same file drained it first, which keeps the
+// awaiter waiting for the next edge.
+struct io_attempt
+{
+    bool (*perform)(io_attempt&) = nullptr;
+};
+
+class epoll_backend
+{
+    struct fd_state
+    {
+        std::coroutine_handle<> reader;
+        std::coroutine_handle<> writer;
+        io_attempt* read_attempt = nullptr;
+        io_attempt* write_attempt = nullptr;
+        bool registered = false;
+    };
+
+public:
+    epoll_backend() : m_epoll_fd(check_fd(epoll_create1(0)))
+    {
+        m_events.resize(32);
+    }
+
+    void add_reader(int fd, std::coroutine_handle<> handle, io_attempt* attempt = nullptr)
+    {
+        auto& state = watch(fd);
+        state.reader = handle;
+        state.read_attempt = attempt;
+    }
+    void add_writer(int fd, std::coroutine_handle<> handle, io_attempt* attempt = nullptr)
+    {
+        auto& state = watch(fd);
+        state.writer = handle;
+        state.write_attempt = attempt;
+    }
+    void remove_reader(int fd)
+    {
+        if (std::size_t(fd) < m_fds.size()) {
+            m_fds[fd].reader = {};
+            m_fds[fd].read_attempt = nullptr;
+        }
+    }
+    void remove_writer(int fd)
+    {
+        if (std::size_t(fd) < m_fds.size()) {
+            m_fds[fd].writer = {};
+            m_fds[fd].write_attempt = nullptr;
+        }
+    }
+    void remove_fd(int fd)
+    {
+        if (std::size_t(fd) < m_fds.size() && m_fds[fd].registered) {
+            m_fds[fd] = {};
+            epoll_ctl(m_epoll_fd.get(), EPOLL_CTL_DEL, fd, nullptr);
+        }
+    }
+
+    template <typename Func>
+    int poll(int timeout, Func&& on_ready)
+    {
+        int n_ready = 0;
+        int n_ev = epoll_wait(m_epoll_fd.get(), m_events.data(), m_events.size(), timeout);
+        for (int i = 0; i < n_ev; ++i) {
+            int fd = m_events[i].data.fd;
+            auto events = m_events[i].events;
+            if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                if (auto h = take(m_fds[fd].reader, m_fds[fd].read_attempt)) {
+                    ++n_ready;
+                    on_ready(h);
+                }
+            }
+            if (events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) {
+                if (auto h = take(m_fds[fd].writer, m_fds[fd].write_attempt)) {
+                    ++n_ready;
+                    on_ready(h);
+                }
+            }
+        }
+        return n_ready;
+    }
+
+private:
+    // The awaiter to resume, unless its attempt would still block.
+    static std::coroutine_handle<> take(std::coroutine_handle<>& handle, io_attempt*& attempt)
+    {
+        if (!handle || (attempt && !attempt->perform(*attempt))) {
+            return {};
+        }
+        attempt = nullptr;
+        return std::exchange(handle, {});
+    }
+    fd_state& watch(int fd)
+    {
+        if (std::size_t(fd) >= m_fds.size()) {
+            m_fds.resize(std::max(std::size_t(fd) + 1, 2 * m_fds.size()));
+        }
+
+        auto& state = m_fds[fd];
+        if (!state.registered) {
+            epoll_event ev{.events=EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, .data={.fd=fd}};
+            check_error(epoll_ctl(m_epoll_fd.get(), EPOLL_CTL_ADD, fd, &ev));
+            state.registered = true;
+        }
+        return state;
+    }
+
+    unique_fd m_epoll_fd;
+    std::pmr::vector<epoll_event> m_events{loop_resource()};
+    std::pmr::vector<fd_state> m_fds{loop_resource()};
+};
+
+}
\ No newline at end of file
@@ -12,6 +12,13 @@ inline void check_error(int ret_val)
     }
 }
 
+inline void check_error_code(int error)
+{
+    if (error != 0) {
+        throw std::system_error(error, std::system_category());
+    }
+}
+
 inline int check_fd(int fd)
 {
     check_error(fd);
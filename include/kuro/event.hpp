@@ -1,14 +1,22 @@
 #pragma once
 
+#include <concepts>
+#include <memory_resource>
+
 #include "continuation.hpp"
 
 namespace kuro
 {
 
-template <continuation_container Continuation = multi_continuation>
+template <continuation_container Continuation = intrusive_continuation>
 class event
 {
 public:
+    event() = default;
+    explicit event(std::pmr::memory_resource* resource)
+        requires std::constructible_from<Continuation, std::pmr::memory_resource*>
+        : m_continuation(resource) {}
+
     void set()
     {
         m_set = true;
@@ -30,18 +38,20 @@ public:
             }
             void await_suspend(std::coroutine_handle<> handle) noexcept
             {
-                m_handle = handle;
-                m_event->m_continuation.push(handle);
+                m_waiter.handle = handle;
+                detail::push_waiter(m_event->m_continuation, m_waiter);
             }
             void await_resume() const noexcept {}
             void await_cancel() noexcept
             {
-                m_event->m_continuation.erase(m_handle);
+                if (!detail::erase_waiter(m_event->m_continuation, m_waiter)) {
+                    m_waiter.unschedule();
+                }
             }
         
         private:
             event* m_event;
-            std::coroutine_handle<> m_handle;
+            detail::waiter_node m_waiter;
         };
 
         return awaitable{this};
@@ -1,108 +1,78 @@
 #pragma once
 
+#include <algorithm>
+#include <chrono>
 #include <coroutine>
+#include <cstdint>
+#include <exception>
 #include <functional>
+#include <future>
+#include <memory>
+#include <memory_resource>
+#include <stdexcept>
+#include <thread>
 #include <unordered_map>
-#include <vector>
+#include <utility>
 
 #include <signal.h>
-#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/signalfd.h>
 #include <unistd.h>
 
-#include "cancellation.hpp"
+#ifdef KURO_USE_IO_URING
+#include "io_uring.hpp"
+#else
+#include "epoll.hpp"
+#endif
+
+#include "eager_task.hpp"
+#include "inbox.hpp"
 #include "promise.hpp"
+#include "ready_queue.hpp"
 #include "shared_task.hpp"
 #include "task.hpp"
 #include "task_executor.hpp"
+#include "thread_pool.hpp"
+#include "time_slice.hpp"
+#include "timer_wheel.hpp"
 #include "unique_fd.hpp"
 #include "util.hpp"
 
 namespace kuro
 {
 
-class event_loop
+namespace detail
 {
-    template <typename T>
-    class active_task
-    {
-    public:
-        class promise_type final : public detail::base_promise_t<T>
-        {
-        public:
-            active_task<T> get_return_object() noexcept
-            {
-                return active_task(std::coroutine_handle<promise_type>::from_promise(*this));
-            }
-            std::suspend_never initial_suspend() const noexcept { return {}; }
-            auto final_suspend() const noexcept
-            {
-                struct awaitable
-                {
-                    bool await_ready() noexcept { return false; }
-                    std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept
-                    {
-                        auto continuation = handle.promise().m_continuation;
-                        if (continuation) {
-                            return continuation;
-                        }
-
-                        return std::noop_coroutine();
-                    }
-                    void await_resume() noexcept {}
-                };
-                return awaitable{};
-            }
-            void set_continuation(std::coroutine_handle<> continuation)
-            {
-                m_continuation = continuation;
-            }
-
-        private:
-            std::coroutine_handle<> m_continuation;
-        };
-
-        T await_resume()
-        {
-            return m_handle.promise().result();
-        }
-        bool await_ready() const noexcept
-        {
-            return m_handle.done();
-        }
-        void await_suspend(std::coroutine_handle<> parent_handle) noexcept
-        {
-            m_handle.promise().set_continuation(parent_handle);
-        }
-        bool done() const noexcept
-        {
-            return m_handle.done();
-        }
 
+#ifdef KURO_USE_IO_URING
+using io_backend = io_uring_backend;
+#else
+using io_backend = epoll_backend;
+#endif
 
-    private:
-        active_task(std::coroutine_handle<promise_type> handle) : m_handle(handle) {}
+}
 
-        detail::unique_coroutine_handle<promise_type> m_handle;
+class event_loop
+{
+public:
+    struct loop_stats
+    {
+        std::uint64_t busy_polls = 0;
+        std::uint64_t empty_busy_polls = 0;
+        std::uint64_t discarded_completions = 0;
     };
 
-public:
     template <typename T>
     static T run(task<T> root_task)
     {
-        auto exec = [](task<T>& t) -> detail::task_executor_return<T> {
+        instance();
+        detail::unique_coroutine_handle exec = [](task<T>& t) -> detail::task_executor_return<T> {
             co_return co_await t;
-        }(root_task);
+        }(root_task).m_handle;
 
         io_loop(root_task);
 
-        if constexpr (std::is_void_v<T>) {
-            exec.m_handle.destroy();
-        } else {
-            T result = exec.m_handle.promise().result();
-            exec.m_handle.destroy();
-            return result;
-        }
+        return exec.promise().result();
     }
     template <typename T>
     static T run(shared_task<T> root_task)
@@ -121,32 +91,189 @@ public:
     }
     static void add_reader(int fd, std::coroutine_handle<> handle)
     {
-        epoll_event ev{.events=EPOLLIN, .data={.fd=fd}};
-        epoll_ctl(instance().m_epoll_fd.get(), EPOLL_CTL_ADD, fd, &ev);
-        instance().m_handles[fd] = handle;
+        instance().m_backend.add_reader(fd, handle);
     }
     static void add_writer(int fd, std::coroutine_handle<> handle)
     {
-        epoll_event ev{.events=EPOLLOUT, .data={.fd=fd}};
-        epoll_ctl(instance().m_epoll_fd.get(), EPOLL_CTL_ADD, fd, &ev);
-        instance().m_handles[fd] = handle;
+        instance().m_backend.add_writer(fd, handle);
+    }
+#ifndef KURO_USE_IO_URING
+    static void add_reader(int fd, std::coroutine_handle<> handle, detail::io_attempt& attempt)
+    {
+        instance().m_backend.add_reader(fd, handle, &attempt);
     }
+    static void add_writer(int fd, std::coroutine_handle<> handle, detail::io_attempt& attempt)
+    {
+        instance().m_backend.add_writer(fd, handle, &attempt);
+    }
+#endif
+    static void remove_reader(int fd)
+    {
+        instance().m_backend.remove_reader(fd);
+    }
+    static void remove_writer(int fd)
+    {
+        instance().m_backend.remove_writer(fd);
+    }
+    // A thread without a loop, e.g. an executor worker closing a socket,
+    // never registered the fd, and doesn't get a loop for it.
     static void remove_fd(int fd)
     {
-        instance().m_handles.erase(fd);
-        epoll_ctl(instance().m_epoll_fd.get(), EPOLL_CTL_DEL, fd, nullptr);
+        if (m_current) {
+            m_current->m_backend.remove_fd(fd);
+        }
+    }
+#ifdef KURO_USE_IO_URING
+    template <typename Prepare>
+    static std::uint32_t submit(std::coroutine_handle<> handle, ssize_t* result, Prepare&& prepare)
+    {
+        return instance().m_backend.submit(handle, result, std::forward<Prepare>(prepare));
+    }
+    static void cancel(std::uint32_t request)
+    {
+        instance().m_backend.cancel(request);
+    }
+    static void abandon(std::uint32_t request)
+    {
+        instance().m_backend.abandon(request);
+    }
+#endif
+    static void call_soon(std::function<void()> callback)
+    {
+        detail::ready_queue::instance().push(std::move(callback));
+    }
+    template <typename Rep, typename Period>
+    static void call_later(std::chrono::duration<Rep, Period> delay, std::function<void()> callback)
+    {
+        struct callback_timer : detail::timer_node
+        {
+            callback_timer(std::function<void()> f) : detail::timer_node(fire), callback(std::move(f)) {}
+            static void fire(detail::timer_node& node)
+            {
+                std::unique_ptr<callback_timer> self(static_cast<callback_timer*>(&node));
+                self->callback();
+            }
+
+            std::function<void()> callback;
+        };
+
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::ceil<std::chrono::steady_clock::duration>(delay);
+        add_timer(*new callback_timer(std::move(callback)), deadline);
+    }
+    static void add_timer(detail::timer_node& node, std::chrono::steady_clock::time_point deadline)
+    {
+        detail::timer_wheel::instance().arm(node, deadline);
+    }
+    static event_loop& current()
+    {
+        return instance();
+    }
+    bool is_current() const noexcept
+    {
+        return m_current == this;
+    }
+    template <typename Func>
+    void post(Func&& callback)
+    {
+        if (m_inbox.push(std::forward<Func>(callback))) {
+            wake();
+        }
+    }
+    // Posts a node the caller owns, which doesn't allocate. It can be
+    // withdrawn on the loop thread until it has run.
+    void post(detail::inbox::node& node)
+    {
+        if (m_inbox.push(node)) {
+            wake();
+        }
+    }
+    bool withdraw(detail::inbox::node& node)
+    {
+        return m_inbox.remove(node);
+    }
+    template <typename Func>
+    auto run_threadsafe(Func&& func)
+    {
+        using result_t = std::invoke_result_t<Func&>;
+        using T = typename threadsafe_result<result_t>::type;
+
+        std::promise<T> promise;
+        auto future = promise.get_future();
+        post([promise = std::move(promise), func = std::forward<Func>(func)]() mutable {
+            try {
+                if constexpr (threadsafe_result<result_t>::is_task) {
+                    [](std::promise<T> p, task<T> t) -> detail::task_executor {
+                        try {
+                            if constexpr (std::is_void_v<T>) {
+                                co_await t;
+                                p.set_value();
+                            } else {
+                                p.set_value(co_await t);
+                            }
+                        } catch (...) {
+                            p.set_exception(std::current_exception());
+                        }
+                    }(std::move(promise), func());
+                } else if constexpr (std::is_void_v<T>) {
+                    func();
+                    promise.set_value();
+                } else {
+                    promise.set_value(func());
+                }
+            } catch (...) {
+                promise.set_exception(std::current_exception());
+            }
+        });
+        return future;
+    }
+    static void set_executor_threads(std::size_t n_threads)
+    {
+        instance().m_executor_threads = std::max<std::size_t>(n_threads, 1);
+    }
+    static detail::thread_pool& executor()
+    {
+        auto& loop = instance();
+        if (!loop.m_executor) {
+            loop.m_executor = std::make_unique<detail::thread_pool>(loop.m_executor_threads);
+        }
+        return *loop.m_executor;
+    }
+    static void set_busy_poll(std::chrono::microseconds budget)
+    {
+        instance().m_busy_poll_budget = budget;
+    }
+    static void set_time_slice(std::chrono::microseconds length, std::size_t max_awaits = 0)
+    {
+        detail::time_slice::instance().configure(length, max_awaits);
+    }
+    static const loop_stats& stats()
+    {
+#ifdef KURO_USE_IO_URING
+        instance().m_stats.discarded_completions = instance().m_backend.discarded_completions();
+#endif
+        return instance().m_stats;
+    }
+    static void set_memory_resource(std::pmr::memory_resource* resource)
+    {
+        if (m_current || detail::ready_queue::constructed()) {
+            throw std::logic_error("set_memory_resource must be called before the event loop is used");
+        }
+        detail::loop_resource() = resource;
     }
     static void add_signal_handler(int signal, std::function<void()> handler)
     {
         detail::check_error(sigaddset(&instance().m_sigmask, signal));
-        detail::check_error(sigprocmask(SIG_SETMASK, &instance().m_sigmask, nullptr));
+        detail::check_error_code(pthread_sigmask(SIG_SETMASK, &instance().m_sigmask, nullptr));
         detail::check_error(signalfd(instance().m_signal_fd.get(), &instance().m_sigmask, 0));
         instance().m_signal_handlers[signal] = std::move(handler);
+        if (!instance().m_signal_dispatcher) {
+            instance().m_signal_dispatcher = dispatch_signals().m_handle;
+        }
     }
     static void remove_signal_handler(int signal)
     {
         detail::check_error(sigdelset(&instance().m_sigmask, signal));
-        detail::check_error(sigprocmask(SIG_SETMASK, &instance().m_sigmask, nullptr));
+        detail::check_error_code(pthread_sigmask(SIG_SETMASK, &instance().m_sigmask, nullptr));
         detail::check_error(signalfd(instance().m_signal_fd.get(), &instance().m_sigmask, 0));
         instance().m_signal_handlers.erase(signal);
     }
@@ -154,7 +281,7 @@ public:
     template <typename T>
     static auto create_task(task<T> concurrent_task)
     {
-        return [](task<T> t) -> active_task<T> {
+        return [](task<T> t) -> eager_task<T> {
             co_return co_await t;
         }(std::move(concurrent_task));
     }
@@ -172,54 +299,160 @@ public:
 private:
     event_loop()
     {
-        m_epoll_fd = epoll_create1(0);
-        m_events.resize(32);
         detail::check_error(sigemptyset(&m_sigmask));
-        m_signal_fd = detail::check_fd(signalfd(-1, &m_sigmask, 0));
-        epoll_event ev{.events=EPOLLIN, .data={.fd=m_signal_fd.get()}};
-        epoll_ctl(m_epoll_fd.get(), EPOLL_CTL_ADD, m_signal_fd.get(), &ev);
+        m_signal_fd = detail::check_fd(signalfd(-1, &m_sigmask, SFD_NONBLOCK));
+        m_inbox_fd = detail::check_fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC));
+        m_inbox_dispatcher = dispatch_inbox(*this).m_handle;
+        m_current = this;
+    }
+    ~event_loop()
+    {
+        m_current = nullptr;
+        if (m_signal_dispatcher) {
+            m_backend.remove_fd(m_signal_fd.get());
+            m_signal_dispatcher.destroy();
+        }
+        m_backend.remove_fd(m_inbox_fd.get());
+        m_inbox_dispatcher.destroy();
+    }
+
+    template <typename T>
+    struct threadsafe_result
+    {
+        using type = T;
+        static constexpr bool is_task = false;
+    };
+    template <typename T>
+    struct threadsafe_result<task<T>>
+    {
+        using type = T;
+        static constexpr bool is_task = true;
+    };
+
+    void wake()
+    {
+        std::uint64_t one = 1;
+        detail::check_error(write(m_inbox_fd.get(), &one, sizeof(one)));
     }
 
     template <typename T>
     static void io_loop(const task<T>& root_task)
     {
-        while (!root_task.done()) {
-            int n_ev = epoll_wait(
-                instance().m_epoll_fd.get(),
-                instance().m_events.data(),
-                instance().m_events.size(),
-                -1
-            );
-            for (int i = 0; i < n_ev; ++i) {
-                int fd = instance().m_events[i].data.fd;
-                if (fd == instance().m_signal_fd.get()) {
-                    signalfd_siginfo info;
-                    if (read(fd, &info, sizeof(info)) != sizeof(info)) {
-                        throw std::runtime_error("Failed to read signal handler info");
-                    }
+        auto& loop = instance();
+        auto& ready = detail::ready_queue::instance();
+        auto& timers = detail::timer_wheel::instance();
+        auto& slice = detail::time_slice::instance();
+        try {
+            while (!root_task.done()) {
+                slice.start();
+                loop.poll_io(ready.empty());
+                timers.expire(std::chrono::steady_clock::now());
+                ready.run_batch();
+                if (loop.m_exception) {
+                    std::rethrow_exception(std::exchange(loop.m_exception, nullptr));
+                }
+            }
+        } catch (...) {
+            ready.clear();
+            throw;
+        }
+        ready.clear();
+    }
 
+    void poll_io(bool may_block)
+    {
+        auto resume = [](std::coroutine_handle<> h) {
+            h.resume();
+        };
+        if (!may_block) {
+            m_backend.poll(0, resume);
+            return;
+        }
+
+        auto& timers = detail::timer_wheel::instance();
+        auto now = std::chrono::steady_clock::now();
+        if (m_busy_poll_budget.count() > 0) {
+            auto spin_until = now + m_busy_poll_budget;
+            while (now < spin_until && timers.timeout(now) != 0) {
+                ++m_stats.busy_polls;
+                if (m_backend.poll(0, resume) > 0) {
+                    return;
+                }
+                ++m_stats.empty_busy_polls;
+                now = std::chrono::steady_clock::now();
+            }
+        }
+        m_backend.poll(timers.timeout(now), resume);
+    }
+
+    struct readable
+    {
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> handle) const
+        {
+            loop.m_backend.add_reader(fd, handle);
+        }
+        void await_resume() const noexcept {}
+
+        event_loop& loop;
+        int fd;
+    };
+
+    static detail::task_executor dispatch_signals()
+    {
+        while (true) {
+            co_await readable{instance(), instance().m_signal_fd.get()};
+            try {
+                signalfd_siginfo info;
+                ssize_t n_bytes;
+                while ((n_bytes = read(instance().m_signal_fd.get(), &info, sizeof(info))) == sizeof(info)) {
                     instance().m_signal_handlers[info.ssi_signo]();
-                } else {
-                    auto h = instance().m_handles[fd];
-                    remove_fd(fd);
-                    h.resume();
                 }
+                if (n_bytes != -1 || errno != EAGAIN) {
+                    throw std::runtime_error("Failed to read signal handler info");
+                }
+            } catch (...) {
+                instance().m_exception = std::current_exception();
+            }
+        }
+    }
+
+    // Started by the constructor, so it must not go through instance().
+    static detail::task_executor dispatch_inbox(event_loop& loop)
+    {
+        while (true) {
+            std::uint64_t count;
+            if (read(loop.m_inbox_fd.get(), &count, sizeof(count)) == -1) {
+                co_await readable{loop, loop.m_inbox_fd.get()};
+                continue;
             }
+            loop.m_inbox.drain([&](std::exception_ptr e) {
+                loop.m_exception = e;
+            });
         }
     }
 
     static event_loop& instance()
     {
-        static event_loop inst;
+        static thread_local event_loop inst;
         return inst;
     }
 
-    detail::unique_fd m_epoll_fd;
-    std::vector<epoll_event> m_events;
-    std::unordered_map<int, std::coroutine_handle<>> m_handles;
+    detail::io_backend m_backend;
     sigset_t m_sigmask;
     detail::unique_fd m_signal_fd;
-    std::unordered_map<int, std::function<void()>> m_signal_handlers;
+    std::pmr::unordered_map<int, std::function<void()>> m_signal_handlers{detail::loop_resource()};
+    std::coroutine_handle<> m_signal_dispatcher;
+    detail::unique_fd m_inbox_fd;
+    detail::inbox m_inbox;
+    std::coroutine_handle<> m_inbox_dispatcher;
+    std::size_t m_executor_threads = std::max(1u, std::thread::hardware_concurrency());
+    std::unique_ptr<detail::thread_pool> m_executor;
+    std::exception_ptr m_exception;
+    std::chrono::microseconds m_busy_poll_budget{0};
+    loop_stats m_stats;
+
+    static inline thread_local event_loop* m_current = nullptr;
 };
 
 }
\ No newline at end of file
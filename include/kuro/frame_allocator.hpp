@@ -0,0 +1,232 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <forward_list>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+
+#include "arena.hpp"
+
+namespace kuro
+{
+
+struct frame_allocator_stats
+{
+    std::uint64_t hits = 0;
+    std::uint64_t misses = 0;
+};
+
+struct frame_allocator_hooks
+{
+    void* (*allocate)(std::size_t size) = nullptr;
+    void (*deallocate)(void* ptr, std::size_t size) = nullptr;
+};
+
+class frame_allocator
+{
+    static constexpr std::size_t granularity = 64;
+    static constexpr std::size_t n_classes = 64;
+    static constexpr std::size_t max_size = granularity * n_classes;
+    static constexpr std::uint32_t max_cached = 256;
+
+    struct free_block
+    {
+        free_block* next;
+    };
+
+    // Trivially destructible, so frames can still be freed at thread exit.
+    struct pool
+    {
+        std::array<free_block*, n_classes> free_lists;
+        std::array<std::uint32_t, n_classes> cached;
+        frame_allocator_stats stats;
+        bool released;
+    };
+
+    struct reaper
+    {
+        ~reaper()
+        {
+            auto& p = local_pool();
+            for (std::size_t i = 0; i < n_classes; ++i) {
+                while (auto block = p.free_lists[i]) {
+                    p.free_lists[i] = block->next;
+                    ::operator delete(block);
+                }
+                p.cached[i] = 0;
+            }
+            p.released = true;
+        }
+    };
+
+public:
+    using deallocate_fn = void (*)(void* ptr, std::size_t size);
+
+    // Also reports the function that frees the block, which stays valid
+    // across later calls to set_hooks.
+    static void* allocate(std::size_t size, deallocate_fn& deallocate)
+    {
+        if (auto h = hooks().load(std::memory_order_acquire)) {
+            deallocate = h->deallocate;
+            return h->allocate(size);
+        }
+
+        deallocate = &frame_allocator::deallocate;
+        if (size > max_size) {
+            ++local_pool().stats.misses;
+            return ::operator new(size);
+        }
+
+        auto& p = local_pool();
+        auto i = size_class(size);
+        if (auto block = p.free_lists[i]) {
+            p.free_lists[i] = block->next;
+            --p.cached[i];
+            ++p.stats.hits;
+            return block;
+        }
+
+        ++p.stats.misses;
+        return ::operator new((i + 1) * granularity);
+    }
+    static void deallocate(void* ptr, std::size_t size) noexcept
+    {
+        auto& p = local_pool();
+        auto i = size_class(size);
+        if (size > max_size || p.released || p.cached[i] == max_cached) {
+            ::operator delete(ptr);
+            return;
+        }
+
+        auto block = static_cast<free_block*>(ptr);
+        block->next = p.free_lists[i];
+        p.free_lists[i] = block;
+        ++p.cached[i];
+    }
+
+    static const frame_allocator_stats& stats() noexcept
+    {
+        return local_pool().stats;
+    }
+    static void set_hooks(frame_allocator_hooks h)
+    {
+        if (!h.allocate != !h.deallocate) {
+            throw std::invalid_argument("frame_allocator hooks need both functions");
+        }
+
+        // Installed hooks are never freed, since another thread may still
+        // be reading the previous ones.
+        static std::mutex mutex;
+        static std::forward_list<frame_allocator_hooks> installed;
+        std::lock_guard lock(mutex);
+        hooks().store(h.allocate ? &installed.emplace_front(h) : nullptr, std::memory_order_release);
+    }
+
+private:
+    static std::size_t size_class(std::size_t size) noexcept
+    {
+        return size == 0 ? 0 : (size - 1) / granularity;
+    }
+    // Every thread that touches its pool, also only to free frames, gets a
+    // reaper that empties it at exit.
+    static pool& local_pool() noexcept
+    {
+        static thread_local pool p{};
+        static thread_local reaper r;
+        return p;
+    }
+    static std::atomic<const frame_allocator_hooks*>& hooks() noexcept
+    {
+        static std::atomic<const frame_allocator_hooks*> h = nullptr;
+        return h;
+    }
+};
+
+namespace detail
+{
+
+// Binds to any coroutine parameter around the arena.
+struct frame_arg
+{
+    frame_arg() = default;
+    template <typename T>
+    frame_arg(T&) noexcept {}
+};
+
+// The parameter shapes that the arena overloads of operator new accept.
+void arena_first(std::allocator_arg_t, arena&, frame_arg = {}, frame_arg = {}, frame_arg = {}, frame_arg = {},
+                 frame_arg = {}, frame_arg = {}, frame_arg = {}, frame_arg = {});
+void arena_second(frame_arg, std::allocator_arg_t, arena&, frame_arg = {}, frame_arg = {}, frame_arg = {}, frame_arg = {},
+                  frame_arg = {}, frame_arg = {}, frame_arg = {}, frame_arg = {});
+
+// Parameters that pass an arena, but in neither of those shapes.
+template <typename... Args>
+concept misplaced_arena = (std::same_as<std::remove_cv_t<Args>, std::allocator_arg_t> || ...) &&
+    (std::same_as<std::remove_cv_t<Args>, arena> || ...) &&
+    !requires (Args&... args) { arena_first(args...); } &&
+    !requires (Args&... args) { arena_second(args...); };
+
+class pooled_frame
+{
+    // Frames are prefixed with the function that frees them, or nullptr
+    // for an arena.
+    static constexpr std::size_t header_size = __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+    static_assert(sizeof(frame_allocator::deallocate_fn) <= header_size);
+
+public:
+    static void* operator new(std::size_t size)
+    {
+        frame_allocator::deallocate_fn deallocate;
+        auto base = frame_allocator::allocate(size + header_size, deallocate);
+        return with_header(base, deallocate);
+    }
+    // Not templates, which GCC would flag with -Wmismatched-new-delete
+    // against the usual operator delete that coroutines call, also with
+    // matching placement deletes.
+    static void* operator new(std::size_t size, std::allocator_arg_t, arena& a,
+                              frame_arg = {}, frame_arg = {}, frame_arg = {}, frame_arg = {},
+                              frame_arg = {}, frame_arg = {}, frame_arg = {}, frame_arg = {})
+    {
+        return with_header(a.allocate(size + header_size, header_size), nullptr);
+    }
+    // For member functions and lambdas, whose first parameter is the object.
+    static void* operator new(std::size_t size, frame_arg, std::allocator_arg_t, arena& a,
+                              frame_arg = {}, frame_arg = {}, frame_arg = {}, frame_arg = {},
+                              frame_arg = {}, frame_arg = {}, frame_arg = {}, frame_arg = {})
+    {
+        return with_header(a.allocate(size + header_size, header_size), nullptr);
+    }
+    // Chosen instead of the pool for a coroutine whose frame would silently
+    // not come from its arena, which makes it a compile error. Not deleted,
+    // since GCC then quietly falls back to the pool.
+    template <typename... Args>
+        requires misplaced_arena<Args...>
+    static void* operator new(std::size_t size, Args&...)
+    {
+        static_assert(!misplaced_arena<Args...>, "a coroutine frame is allocated from an arena only if its parameters start with (std::allocator_arg_t, arena&), or have them second, followed by at most eight more");
+        return operator new(size);
+    }
+    static void operator delete(void* ptr, std::size_t size) noexcept
+    {
+        auto base = static_cast<char*>(ptr) - header_size;
+        if (auto deallocate = *reinterpret_cast<frame_allocator::deallocate_fn*>(base)) {
+            deallocate(base, size + header_size);
+        }
+    }
+
+private:
+    static void* with_header(void* base, frame_allocator::deallocate_fn deallocate) noexcept
+    {
+        *static_cast<frame_allocator::deallocate_fn*>(base) = deallocate;
+        return static_cast<char*>(base) + header_size;
+    }
+};
+}
+
+}
\ No newline at end of file
@@ -1,7 +1,15 @@
 #pragma once
 
+#include <array>
 #include <coroutine>
+#include <cstddef>
+#include <functional>
+#include <optional>
+#include <ranges>
 #include <tuple>
+#include <type_traits>
+#include <variant>
+#include <vector>
 
 #include "util.hpp"
 
@@ -11,42 +19,185 @@ namespace kuro
 namespace detail
 {
 
+// Counts the completions of a gather's pending awaitables. One more
+// completion than there are pending awaitables is expected, the last one
+// being counted once they have all been suspended. A task notifies the
+// counter directly, the last one continuing with the gathering coroutine, so
+// a gather of tasks allocates no frame. Other awaitables share the counter's
+// frame, allocated from the pool once the first of them is suspended. A
+// cancellable gather keeps a child per awaitable, so that only the pending
+// ones are cancelled. An awaitable that can't report through await_done()
+// whether it is pending resumes the child's own frame instead, which records
+// that it is done.
+class completion_counter : public resume_callback<completion_counter, true>, completion_hook
+{
+    friend resume_callback<completion_counter, true>;
+
+public:
+    completion_counter() noexcept : completion_hook{notify_counter} {}
+
+    class child : public resume_callback<child>
+    {
+        friend resume_callback<child>;
+        friend completion_counter;
+
+        std::coroutine_handle<> on_resume() noexcept
+        {
+            return std::exchange(m_counter, nullptr)->complete();
+        }
+
+        completion_counter* m_counter = nullptr;
+        bool m_cancelled = false;
+        bool m_cancelling = false;
+    };
+
+    void start(std::size_t n_pending, std::coroutine_handle<> continuation) noexcept
+    {
+        m_remaining = n_pending + 1;
+        m_continuation = continuation;
+    }
+    std::coroutine_handle<> complete() noexcept
+    {
+        return --m_remaining == 0 ? m_continuation : std::noop_coroutine();
+    }
+    bool complete_last() noexcept
+    {
+        return --m_remaining == 0;
+    }
+    template <typename A>
+    void suspend(A& awaitable)
+    {
+        if constexpr (hook_notifiable<A>) {
+            awaitable.await_notify(*this).resume();
+        } else if (!suspend_on(awaitable, handle())) {
+            --m_remaining;
+        }
+    }
+    template <typename A>
+    void suspend(A& awaitable, child& c)
+    {
+        c.m_counter = this;
+        bool suspended;
+        if constexpr (hook_notifiable<A> && completion_observable<A>) {
+            awaitable.await_notify(*this).resume();
+            suspended = true;
+        } else if constexpr (completion_observable<A>) {
+            suspended = suspend_on(awaitable, handle());
+        } else {
+            suspended = suspend_on(awaitable, c.handle());
+        }
+        if (!suspended) {
+            c.m_counter = nullptr;
+            --m_remaining;
+        }
+    }
+
+    // Returns false while the awaitable is still to resume the gather.
+    template <typename A>
+    bool cancel(A& awaitable, child& c)
+    {
+        if (!pending(awaitable, c)) {
+            return true;
+        }
+        if (c.m_cancelling) {
+            return false;
+        }
+        c.m_cancelling = true;
+        if (!try_cancel(awaitable)) {
+            return false;
+        }
+        c.m_counter = nullptr;
+        c.m_cancelled = true;
+        --m_remaining;
+        return true;
+    }
+    template <typename A>
+    static bool cancelled(A& awaitable, const child& c)
+    {
+        return c.m_cancelled || (c.m_cancelling && was_cancelled(awaitable));
+    }
+
+private:
+    template <typename A>
+    static bool pending(const A& awaitable, const child& c)
+    {
+        if constexpr (completion_observable<A>) {
+            return c.m_counter && !awaitable.await_done();
+        } else {
+            return c.m_counter;
+        }
+    }
+
+    std::coroutine_handle<> on_resume() noexcept
+    {
+        return complete();
+    }
+    static std::coroutine_handle<> notify_counter(completion_hook& hook) noexcept
+    {
+        return static_cast<completion_counter&>(hook).complete();
+    }
+
+    std::size_t m_remaining = 0;
+    std::coroutine_handle<> m_continuation;
+};
+
+template <typename U>
+decltype(auto) non_void_resume(U& await)
+{
+    if constexpr (std::is_void_v<decltype(await.await_resume())>) {
+        await.await_resume();
+        return void_t{};
+    } else {
+        return await.await_resume();
+    }
+}
+
+template <auto Start, auto End, auto Inc, class F>
+constexpr void constexpr_for(F&& f)
+{
+    if constexpr (Start < End) {
+        f(std::integral_constant<decltype(Start), Start>());
+        constexpr_for<Start + Inc, End, Inc>(f);
+    }
+}
+
 template <typename... T>
 class gather_impl
 {
+protected:
+    static constexpr bool tracked = (cancellable<T> && ...);
+
 public:
     gather_impl(T... args) : m_await(detail::awaitable_container<T>(std::forward<T>(args))...) {}
 
     bool await_ready() noexcept
     {
         std::size_t n_ready = 0;
-        constexpr_for<0UL, std::tuple_size_v<decltype(m_await)>, 1UL>([this, &n_ready](auto i) mutable {
-            n_ready += std::get<i.value>(m_await).get().await_ready();
+        constexpr_for<0UL, sizeof...(T), 1UL>([this, &n_ready](auto i) mutable {
+            m_ready[i] = std::get<i.value>(m_await).get().await_ready();
+            n_ready += m_ready[i];
         });
 
-        return n_ready == std::tuple_size_v<decltype(m_await)>;
+        return n_ready == sizeof...(T);
     }
-    void await_suspend(std::coroutine_handle<> handle) noexcept
+    bool await_suspend(std::coroutine_handle<> handle)
     {
-        std::coroutine_handle<> inc_handle = [this](std::coroutine_handle<> resume) -> detail::task_executor {
-            for (auto i = 0UL; i < std::tuple_size_v<decltype(m_await)>; ++i) {
-                co_await std::suspend_always{};
-            }
-            resume.resume();
-        }(handle).m_handle;
-
-        constexpr_for<0UL, std::tuple_size_v<decltype(m_await)>, 1UL>([this, inc_handle](auto i) {
-            using S = decltype(std::get<i.value>(m_await).get().await_suspend(inc_handle));
-            if constexpr (std::is_void_v<S>) {
-                std::get<i.value>(m_await).get().await_suspend(inc_handle);
-            } else if constexpr (std::is_same_v<S, bool>) {
-                if (!std::get<i.value>(m_await).get().await_suspend(inc_handle)) {
-                    inc_handle.resume();
+        std::size_t n_pending = 0;
+        for (auto ready : m_ready) {
+            n_pending += !ready;
+        }
+
+        m_counter.start(n_pending, handle);
+        constexpr_for<0UL, sizeof...(T), 1UL>([this](auto i) {
+            if (!m_ready[i]) {
+                if constexpr (tracked) {
+                    m_counter.suspend(std::get<i.value>(m_await).get(), m_children[i]);
+                } else {
+                    m_counter.suspend(std::get<i.value>(m_await).get());
                 }
-            } else {
-                std::get<i.value>(m_await).get().await_suspend(inc_handle).resume();
             }
         });
+        return !m_counter.complete_last();
     }
     auto await_resume() noexcept
     {
@@ -56,41 +207,320 @@ public:
     }
 
 protected:
-    template <typename U>
-    static decltype(auto) non_void_resume(U& await)
+    std::tuple<detail::awaitable_container<T>...> m_await;
+    std::array<bool, sizeof...(T)> m_ready{};
+    completion_counter m_counter;
+    std::array<completion_counter::child, tracked ? sizeof...(T) : 0> m_children;
+};
+
+template <typename... T>
+class gather_cancel_impl : public gather_impl<T...>
+{
+public:
+    gather_cancel_impl(T... args) : gather_impl<T...>(std::forward<T>(args)...) {}
+
+    // Awaitables that already completed are left alone, and the gather
+    // completes once those that couldn't be cancelled at once are done.
+    bool await_cancel() noexcept
     {
-        if constexpr (std::is_void_v<decltype(await.await_resume())>) {
-            await.await_resume();
-            return void_t{};
-        } else {
-            return await.await_resume();
+        bool cancelled = true;
+        constexpr_for<0UL, sizeof...(T), 1UL>([this, &cancelled](auto i) mutable {
+            cancelled &= this->m_counter.cancel(std::get<i.value>(this->m_await).get(), this->m_children[i]);
+        });
+        return cancelled;
+    }
+    bool await_cancelled()
+    {
+        bool cancelled = false;
+        constexpr_for<0UL, sizeof...(T), 1UL>([this, &cancelled](auto i) mutable {
+            cancelled |= completion_counter::cancelled(std::get<i.value>(this->m_await).get(), this->m_children[i]);
+        });
+        return cancelled;
+    }
+};
+
+// A range that owns its awaitables and is about to go away hands them over
+// to the gather, which may outlive it. Any other range is referred to.
+template <typename Range>
+using range_awaitable_t = std::conditional_t<std::ranges::borrowed_range<Range>,
+    std::ranges::range_reference_t<Range>, std::ranges::range_value_t<Range>>;
+
+template <typename T>
+using gathered_t = std::conditional_t<std::is_reference_v<T>, std::reference_wrapper<std::remove_reference_t<T>>, T>;
+
+// A gather over a runtime-sized range, with all its awaitables of the same
+// type, stored contiguously.
+template <typename T>
+class gather_range_impl
+{
+    static constexpr bool tracked = cancellable<T>;
+
+public:
+    template <typename Range>
+    gather_range_impl(Range&& range)
+    {
+        if constexpr (std::ranges::sized_range<Range>) {
+            m_await.reserve(std::ranges::size(range));
+        }
+        for (auto&& aw : range) {
+            if constexpr (std::is_reference_v<T>) {
+                m_await.emplace_back(std::forward<decltype(aw)>(aw));
+            } else {
+                m_await.emplace_back(std::move(aw));
+            }
         }
+        m_ready.resize(m_await.size());
     }
 
-    template <auto Start, auto End, auto Inc, class F>
-    static constexpr void constexpr_for(F&& f)
+    bool await_ready()
     {
-        if constexpr (Start < End) {
-            f(std::integral_constant<decltype(Start), Start>());
-            constexpr_for<Start + Inc, End, Inc>(f);
+        std::size_t n_ready = 0;
+        for (std::size_t i = 0; i < m_await.size(); ++i) {
+            m_ready[i] = m_await[i].get().await_ready();
+            n_ready += m_ready[i];
         }
+        return n_ready == m_await.size();
     }
+    bool await_suspend(std::coroutine_handle<> handle)
+    {
+        std::size_t n_pending = 0;
+        for (auto ready : m_ready) {
+            n_pending += !ready;
+        }
 
-    std::tuple<detail::awaitable_container<T>...> m_await;
+        m_counter.start(n_pending, handle);
+        if constexpr (tracked) {
+            m_children.resize(m_await.size());
+        }
+        for (std::size_t i = 0; i < m_await.size(); ++i) {
+            if (m_ready[i]) {
+                continue;
+            }
+            if constexpr (tracked) {
+                m_counter.suspend(m_await[i].get(), m_children[i]);
+            } else {
+                m_counter.suspend(m_await[i].get());
+            }
+        }
+        return !m_counter.complete_last();
+    }
+    auto await_resume()
+    {
+        using result_t = awaited_t<T>;
+        if constexpr (std::is_void_v<result_t>) {
+            for (auto& aw : m_await) {
+                aw.get().await_resume();
+            }
+        } else {
+            std::vector<gathered_t<result_t>> results;
+            results.reserve(m_await.size());
+            for (auto& aw : m_await) {
+                results.push_back(aw.get().await_resume());
+            }
+            return results;
+        }
+    }
+    bool await_cancel() noexcept
+        requires cancellable<T>
+    {
+        bool cancelled = true;
+        for (std::size_t i = 0; i < m_await.size(); ++i) {
+            cancelled &= m_counter.cancel(m_await[i].get(), m_children[i]);
+        }
+        return cancelled;
+    }
+    bool await_cancelled()
+        requires cancellable<T>
+    {
+        for (std::size_t i = 0; i < m_await.size(); ++i) {
+            if (completion_counter::cancelled(m_await[i].get(), m_children[i])) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    std::vector<awaitable_container<T>> m_await;
+    std::vector<bool> m_ready;
+    completion_counter m_counter;
+    std::vector<completion_counter::child> m_children;
 };
 
+// Races its awaitables: the first one to complete wins, and the others are
+// cancelled as soon as it does. It completes once the losers that couldn't
+// be cancelled at once are done too. Awaitables that report through
+// await_done() whether they are done share one frame, which asks them which
+// one completed. Any other awaitable resumes a racer frame of its own.
 template <typename... T>
-class gather_cancel_impl : public gather_impl<T...>
+class when_any_impl
 {
+    static constexpr std::size_t none = sizeof...(T);
+    static constexpr std::size_t cancelled = none + 1;
+
+    class racer : public resume_callback<racer>
+    {
+        friend resume_callback<racer>;
+
+    public:
+        when_any_impl* owner;
+        std::size_t index;
+
+    private:
+        std::coroutine_handle<> on_resume() noexcept
+        {
+            return owner->finish(index);
+        }
+    };
+
+    class observer : public resume_callback<observer, true>
+    {
+        friend resume_callback<observer, true>;
+
+    public:
+        when_any_impl* owner;
+
+    private:
+        std::coroutine_handle<> on_resume() noexcept
+        {
+            return owner->finish_observed();
+        }
+    };
+
 public:
-    gather_cancel_impl(T... args) : gather_impl<T...>(std::forward<T>(args)...) {}
+    using result_type = std::variant<gathered_t<non_void_awaited_t<T>>...>;
+
+    when_any_impl(T... args) : m_await(awaitable_container<T>(std::forward<T>(args))...) {}
 
-    void await_cancel() noexcept
+    bool await_ready()
     {
-        constexpr_for<0UL, std::tuple_size_v<decltype(this->m_await)>, 1UL>([this](auto i) mutable {
-            std::get<i.value>(this->m_await).get().await_cancel();
+        constexpr_for<0UL, sizeof...(T), 1UL>([this](auto i) {
+            if (m_winner == none && std::get<i.value>(m_await).get().await_ready()) {
+                m_winner = i;
+            }
         });
+        return m_winner != none;
     }
+    bool await_suspend(std::coroutine_handle<> handle)
+    {
+        m_continuation = handle;
+        m_suspending = true;
+        constexpr_for<0UL, sizeof...(T), 1UL>([this](auto i) {
+            if (m_winner != none) {
+                return;
+            }
+            auto& aw = std::get<i.value>(m_await).get();
+            std::coroutine_handle<> resume;
+            if constexpr (completion_observable<std::remove_reference_t<decltype(aw)>>) {
+                m_observer.owner = this;
+                resume = m_observer.handle();
+            } else {
+                m_racers[i].owner = this;
+                m_racers[i].index = i;
+                resume = m_racers[i].handle();
+            }
+            m_suspended[i] = true;
+            if (!suspend_on(aw, resume)) {
+                m_suspended[i] = false;
+                m_winner = i;
+            }
+        });
+        m_suspending = false;
+
+        if (m_winner == none) {
+            return true;
+        }
+        cancel_losers();
+        return m_outstanding != 0;
+    }
+    result_type await_resume()
+    {
+        std::optional<result_type> result;
+        constexpr_for<0UL, sizeof...(T), 1UL>([this, &result](auto i) {
+            if (i == m_winner) {
+                result.emplace(std::in_place_index<i.value>, non_void_resume(std::get<i.value>(m_await).get()));
+            }
+        });
+        return std::move(*result);
+    }
+    bool await_cancel()
+    {
+        if (m_winner == none) {
+            m_winner = cancelled;
+            cancel_losers();
+        }
+        return m_winner == cancelled && m_outstanding == 0;
+    }
+    bool await_cancelled() const noexcept
+    {
+        return m_winner == cancelled;
+    }
+
+private:
+    std::coroutine_handle<> finish(std::size_t i)
+    {
+        m_suspended[i] = false;
+        if (m_cancelling[i]) {
+            // A racer that completed although it was cancelled wins when
+            // the race itself was cancelled.
+            m_cancelling[i] = false;
+            --m_outstanding;
+            constexpr_for<0UL, sizeof...(T), 1UL>([this, i](auto j) {
+                if (j == i && m_winner == cancelled && !was_cancelled(std::get<j.value>(m_await).get())) {
+                    m_winner = i;
+                }
+            });
+        } else if (m_winner == none) {
+            m_winner = i;
+            if (m_suspending) {
+                return std::noop_coroutine();
+            }
+            cancel_losers();
+        }
+
+        if (m_suspending || m_outstanding != 0) {
+            return std::noop_coroutine();
+        }
+        return m_continuation;
+    }
+    // Only the awaitable that resumed the observer is done but not yet
+    // finished.
+    std::coroutine_handle<> finish_observed()
+    {
+        std::size_t done = none;
+        constexpr_for<0UL, sizeof...(T), 1UL>([this, &done](auto i) {
+            auto& aw = std::get<i.value>(m_await).get();
+            if constexpr (completion_observable<std::remove_reference_t<decltype(aw)>>) {
+                if (m_suspended[i] && aw.await_done()) {
+                    done = i;
+                }
+            }
+        });
+        return finish(done);
+    }
+    void cancel_losers()
+    {
+        constexpr_for<0UL, sizeof...(T), 1UL>([this](auto i) {
+            if (i != m_winner && m_suspended[i] && !m_cancelling[i]) {
+                if (try_cancel(std::get<i.value>(m_await).get())) {
+                    m_suspended[i] = false;
+                } else {
+                    m_cancelling[i] = true;
+                    ++m_outstanding;
+                }
+            }
+        });
+    }
+
+    std::tuple<awaitable_container<T>...> m_await;
+    std::array<racer, sizeof...(T)> m_racers;
+    observer m_observer;
+    std::array<bool, sizeof...(T)> m_suspended{};
+    std::array<bool, sizeof...(T)> m_cancelling{};
+    std::size_t m_outstanding = 0;
+    std::size_t m_winner = none;
+    bool m_suspending = false;
+    std::coroutine_handle<> m_continuation;
 };
 
 }
@@ -106,5 +536,18 @@ auto gather(T&&... args)
     }
 }
 
+template <std::ranges::input_range Range>
+    requires awaitable<std::ranges::range_reference_t<Range>>
+auto gather(Range&& range)
+{
+    return detail::gather_range_impl<detail::range_awaitable_t<Range>>(std::forward<Range>(range));
+}
+
+template <cancellable_awaitable... T>
+    requires (sizeof...(T) > 0)
+auto when_any(T&&... args)
+{
+    return detail::when_any_impl<T...>(std::forward<T>(args)...);
+}
 
 }
\ No newline at end of file
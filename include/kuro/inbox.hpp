@@ -0,0 +1,133 @@
+#pragma once
+
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+namespace kuro::detail
+{
+
+class inbox
+{
+public:
+    // Pushed callbacks are allocated and own themselves, other nodes are
+    // owned by whoever pushes them, e.g. embedded in an awaitable.
+    struct node
+    {
+        virtual void run() = 0;
+        virtual void discard() noexcept {}
+
+        node* next = nullptr;
+
+    protected:
+        ~node() = default;
+    };
+
+private:
+    template <typename Func>
+    struct callback_node final : node
+    {
+        explicit callback_node(Func f) : func(std::move(f)) {}
+        void run() override
+        {
+            std::unique_ptr<callback_node> self(this);
+            func();
+        }
+        void discard() noexcept override
+        {
+            delete this;
+        }
+
+        Func func;
+    };
+
+public:
+    inbox() = default;
+    inbox(const inbox&) = delete;
+    inbox& operator=(const inbox&) = delete;
+    ~inbox()
+    {
+        auto n = m_head.exchange(nullptr, std::memory_order_acquire);
+        while (n) {
+            std::exchange(n, n->next)->discard();
+        }
+    }
+
+    template <typename Func>
+    bool push(Func&& func)
+    {
+        node& n = *new callback_node<std::decay_t<Func>>(std::forward<Func>(func));
+        return push(n);
+    }
+    bool push(node& n)
+    {
+        auto head = m_head.load(std::memory_order_relaxed);
+        do {
+            n.next = head;
+        } while (!m_head.compare_exchange_weak(head, &n, std::memory_order_release, std::memory_order_relaxed));
+        return head == nullptr;
+    }
+    // Takes a pushed node out before it runs, from the draining thread. The
+    // other nodes go back in the order they were pushed.
+    bool remove(node& target)
+    {
+        if (unlink(m_batch, target)) {
+            return true;
+        }
+
+        auto n = m_head.exchange(nullptr, std::memory_order_acquire);
+        bool found = unlink(n, target);
+
+        node* empty = nullptr;
+        while (n && !m_head.compare_exchange_strong(empty, n, std::memory_order_release, std::memory_order_relaxed)) {
+            // Nodes pushed meanwhile are newer, so they go on top.
+            auto newer = m_head.exchange(nullptr, std::memory_order_acquire);
+            auto tail = newer;
+            while (tail->next) {
+                tail = tail->next;
+            }
+            tail->next = n;
+            n = newer;
+            empty = nullptr;
+        }
+        return found;
+    }
+
+    template <typename OnException>
+    void drain(OnException&& on_exception)
+    {
+        auto n = m_head.exchange(nullptr, std::memory_order_acquire);
+        while (n) {
+            m_batch = std::exchange(n, std::exchange(n->next, m_batch));
+        }
+
+        while (m_batch) {
+            auto current = std::exchange(m_batch, m_batch->next);
+            try {
+                current->run();
+            } catch (...) {
+                on_exception(std::current_exception());
+            }
+        }
+    }
+
+private:
+    static bool unlink(node*& list, node& target)
+    {
+        for (auto link = &list; *link; link = &(*link)->next) {
+            if (*link == &target) {
+                *link = target.next;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::atomic<node*> m_head = nullptr;
+    // The nodes being drained, in order, so that remove() finds them too.
+    node* m_batch = nullptr;
+};
+
+}
\ No newline at end of file
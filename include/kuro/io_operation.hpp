@@ -0,0 +1,225 @@
+#pragma once
+
+#include <cerrno>
+#include <coroutine>
+#include <cstdint>
+#include <utility>
+
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/types.h>
+
+#include "event_loop.hpp"
+#include "result.hpp"
+#include "unique_fd.hpp"
+
+namespace kuro::detail
+{
+
+enum class io_direction
+{
+    read,
+    write
+};
+
+inline ssize_t to_result(ssize_t ret)
+{
+    return ret < 0 ? -errno : ret;
+}
+
+inline ssize_t from_result(ssize_t result)
+{
+    if (result < 0) {
+        errno = -result;
+        return -1;
+    }
+    return result;
+}
+
+// Operations with a start() step try it first, and once it would block wait
+// for readiness and then perform(), on either backend.
+template <typename Operation>
+concept started_operation = requires(Operation& op) { op.start(); };
+
+template <typename Operation, io_direction Direction>
+class io_operation
+{
+public:
+    io_operation(int fd) : m_fd(fd) {}
+
+#ifdef KURO_USE_IO_URING
+    ~io_operation()
+    {
+        if (m_result == io_uring_backend::pending_result) {
+            event_loop::abandon(m_request);
+        }
+    }
+
+    bool await_ready()
+    {
+        if constexpr (started_operation<Operation>) {
+            m_result = static_cast<Operation*>(this)->start();
+            return !would_block();
+        }
+        return false;
+    }
+    void await_suspend(std::coroutine_handle<> handle)
+    {
+        m_request = event_loop::submit(handle, &m_result, [this](io_uring_sqe& sqe) {
+            if constexpr (started_operation<Operation>) {
+                sqe.opcode = IORING_OP_POLL_ADD;
+                sqe.fd = m_fd;
+                sqe.poll32_events = Direction == io_direction::read ? POLLIN : POLLOUT;
+                m_polled = true;
+            } else {
+                static_cast<Operation*>(this)->prepare(sqe);
+            }
+        });
+    }
+    auto await_resume()
+    {
+        return static_cast<Operation*>(this)->complete(final_result());
+    }
+    auto try_resume()
+    {
+        return to_result_type(final_result());
+    }
+    // The request completes either way, possibly with its result if the
+    // operation won the race, and resumes the awaiter then.
+    bool await_cancel()
+    {
+        event_loop::cancel(m_request);
+        return false;
+    }
+    bool await_cancelled() const noexcept
+    {
+        return m_result == -ECANCELED || m_result == -EINTR;
+    }
+#else
+    bool await_ready()
+    {
+        if constexpr (started_operation<Operation>) {
+            m_result = static_cast<Operation*>(this)->start();
+        } else {
+            m_result = static_cast<Operation*>(this)->perform();
+        }
+        return !would_block();
+    }
+    // The operation is performed by the loop once the fd is ready, and the
+    // awaiter is only resumed when it no longer would block.
+    void await_suspend(std::coroutine_handle<> handle)
+    {
+        m_attempt.self = this;
+        if constexpr (Direction == io_direction::read) {
+            event_loop::add_reader(m_fd, handle, m_attempt);
+        } else {
+            event_loop::add_writer(m_fd, handle, m_attempt);
+        }
+    }
+    auto await_resume()
+    {
+        return static_cast<Operation*>(this)->complete(m_result);
+    }
+    auto try_resume()
+    {
+        return to_result_type(m_result);
+    }
+    void await_cancel() const
+    {
+        if constexpr (Direction == io_direction::read) {
+            event_loop::remove_reader(m_fd);
+        } else {
+            event_loop::remove_writer(m_fd);
+        }
+    }
+#endif
+
+protected:
+    int m_fd;
+
+private:
+    // Failed operations never reach complete(), which is free to throw.
+    auto to_result_type(ssize_t ret)
+    {
+        using value_t = decltype(static_cast<Operation*>(this)->complete(ret));
+        if (ret < 0) {
+            return result<value_t>(std::error_code(-ret, std::system_category()));
+        }
+        return result<value_t>(static_cast<Operation*>(this)->complete(ret));
+    }
+    bool would_block() const
+    {
+        return m_result == -EAGAIN || m_result == -EWOULDBLOCK;
+    }
+
+#ifdef KURO_USE_IO_URING
+    ssize_t final_result()
+    {
+        if (m_polled && m_result >= 0) {
+            m_polled = false;
+            m_result = static_cast<Operation*>(this)->perform();
+        }
+        return m_result;
+    }
+
+    std::uint32_t m_request;
+    bool m_polled = false;
+#else
+    struct attempt : io_attempt
+    {
+        attempt() : io_attempt{perform_ready} {}
+        io_operation* self = nullptr;
+    };
+
+    // What perform() reports after start() is final, e.g. the EAGAIN of a
+    // unix socket connect retried against a full backlog.
+    static bool perform_ready(io_attempt& a)
+    {
+        auto self = static_cast<attempt&>(a).self;
+        self->m_result = static_cast<Operation*>(self)->perform();
+        return started_operation<Operation> || !self->would_block();
+    }
+
+    attempt m_attempt;
+#endif
+    ssize_t m_result = 0;
+};
+
+class watched_fd
+{
+public:
+    watched_fd() = default;
+    explicit watched_fd(int fd) : m_fd(fd) {}
+    watched_fd(watched_fd&&) = default;
+    watched_fd& operator=(watched_fd&& other)
+    {
+        release();
+        m_fd = std::move(other.m_fd);
+        return *this;
+    }
+    ~watched_fd()
+    {
+        release();
+    }
+
+    explicit operator bool() const noexcept
+    {
+        return bool(m_fd);
+    }
+    int get() const noexcept
+    {
+        return m_fd.get();
+    }
+
+private:
+    void release()
+    {
+        if (m_fd) {
+            event_loop::remove_fd(m_fd.get());
+        }
+    }
+
+    unique_fd m_fd;
+};
+
+}
\ No newline at end of file
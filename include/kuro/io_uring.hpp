@@ -0,0 +1,359 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <coroutine>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory_resource>
+#include <utility>
+#include <vector>
+
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "error.hpp"
+#include "ready_queue.hpp"
+#include "unique_fd.hpp"
+
+namespace kuro::detail
+{
+
+class io_uring_backend
+{
+    static constexpr std::uint32_t no_request = std::numeric_limits<std::uint32_t>::max();
+    static constexpr std::uint64_t ignored_request = std::numeric_limits<std::uint64_t>::max();
+
+    struct request
+    {
+        std::coroutine_handle<> handle;
+        ssize_t* result = nullptr;
+        int poll_fd = -1;
+        bool poll_writer = false;
+        std::uint8_t opcode = IORING_OP_NOP;
+    };
+
+    struct poll_state
+    {
+        std::uint32_t reader = no_request;
+        std::uint32_t writer = no_request;
+    };
+
+public:
+    // What a request's result holds until its completion arrives.
+    static constexpr ssize_t pending_result = std::numeric_limits<ssize_t>::min();
+
+    io_uring_backend(unsigned entries = 256) : m_ring_fd(setup(entries, m_params))
+    {
+        m_sq_ring_size = m_params.sq_off.array + m_params.sq_entries * sizeof(unsigned);
+        m_cq_ring_size = m_params.cq_off.cqes + m_params.cq_entries * sizeof(io_uring_cqe);
+        bool single_mmap = m_params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single_mmap) {
+            m_sq_ring_size = m_cq_ring_size = std::max(m_sq_ring_size, m_cq_ring_size);
+        }
+
+        m_sq_ring = map(m_sq_ring_size, IORING_OFF_SQ_RING);
+        m_cq_ring = single_mmap ? m_sq_ring : map(m_cq_ring_size, IORING_OFF_CQ_RING);
+        m_sqes = static_cast<io_uring_sqe*>(map(m_params.sq_entries * sizeof(io_uring_sqe), IORING_OFF_SQES));
+
+        auto sq = static_cast<char*>(m_sq_ring);
+        m_sq_head = reinterpret_cast<unsigned*>(sq + m_params.sq_off.head);
+        m_sq_tail = reinterpret_cast<unsigned*>(sq + m_params.sq_off.tail);
+        m_sq_mask = *reinterpret_cast<unsigned*>(sq + m_params.sq_off.ring_mask);
+        auto sq_array = reinterpret_cast<unsigned*>(sq + m_params.sq_off.array);
+        for (unsigned i = 0; i < m_params.sq_entries; ++i) {
+            sq_array[i] = i;
+        }
+        m_sq_local_tail = *m_sq_tail;
+
+        auto cq = static_cast<char*>(m_cq_ring);
+        m_cq_head = reinterpret_cast<unsigned*>(cq + m_params.cq_off.head);
+        m_cq_tail = reinterpret_cast<unsigned*>(cq + m_params.cq_off.tail);
+        m_cq_mask = *reinterpret_cast<unsigned*>(cq + m_params.cq_off.ring_mask);
+        m_cqes = reinterpret_cast<io_uring_cqe*>(cq + m_params.cq_off.cqes);
+    }
+    io_uring_backend(const io_uring_backend&) = delete;
+    io_uring_backend& operator=(const io_uring_backend&) = delete;
+    ~io_uring_backend()
+    {
+        munmap(m_sqes, m_params.sq_entries * sizeof(io_uring_sqe));
+        if (m_cq_ring != m_sq_ring) {
+            munmap(m_cq_ring, m_cq_ring_size);
+        }
+        munmap(m_sq_ring, m_sq_ring_size);
+    }
+
+    template <typename Prepare>
+    std::uint32_t submit(std::coroutine_handle<> handle, ssize_t* result, Prepare&& prepare)
+    {
+        *result = pending_result;
+        auto id = allocate(request{handle, result});
+        auto& sqe = next_sqe();
+        prepare(sqe);
+        sqe.user_data = id;
+        m_requests[id].opcode = sqe.opcode;
+        return id;
+    }
+    // The request still completes as usual, with -ECANCELED, or with its
+    // result if the operation won the race, so its buffers stay in use
+    // until the awaiter is resumed.
+    void cancel(std::uint32_t id)
+    {
+        auto& sqe = next_sqe();
+        sqe.opcode = IORING_OP_ASYNC_CANCEL;
+        sqe.fd = -1;
+        sqe.addr = id;
+        sqe.user_data = ignored_request;
+        enter(0, 0);
+    }
+    // For an awaiter that goes away while its request is pending: cancels
+    // the request and waits for its completion, since the kernel may still
+    // use the awaiter's buffers until then. Completions of other requests
+    // that arrive meanwhile resume their awaiters from the ready queue.
+    void abandon(std::uint32_t id)
+    {
+        ssize_t result = pending_result;
+        m_requests[id].handle = {};
+        m_requests[id].result = &result;
+        cancel(id);
+        while (result == pending_result) {
+            enter(1, IORING_ENTER_GETEVENTS);
+            reap([](std::coroutine_handle<> handle) {
+                ready_queue::instance().push(handle);
+            });
+        }
+    }
+
+    void add_reader(int fd, std::coroutine_handle<> handle)
+    {
+        add_poll(fd, false, handle);
+    }
+    void add_writer(int fd, std::coroutine_handle<> handle)
+    {
+        add_poll(fd, true, handle);
+    }
+    void remove_reader(int fd)
+    {
+        if (std::size_t(fd) < m_polls.size()) {
+            remove_poll(m_polls[fd].reader);
+        }
+    }
+    void remove_writer(int fd)
+    {
+        if (std::size_t(fd) < m_polls.size()) {
+            remove_poll(m_polls[fd].writer);
+        }
+    }
+    void remove_fd(int fd)
+    {
+        remove_reader(fd);
+        remove_writer(fd);
+    }
+
+    template <typename Func>
+    int poll(int timeout, Func&& on_ready)
+    {
+        if (timeout == 0 || completion_pending()) {
+            enter(0, 0);
+        } else if (timeout < 0) {
+            enter(1, IORING_ENTER_GETEVENTS);
+        } else {
+            __kernel_timespec ts{.tv_sec=timeout / 1000, .tv_nsec=(timeout % 1000) * 1'000'000L};
+            io_uring_getevents_arg arg{
+                .sigmask=0,
+                .sigmask_sz=_NSIG / 8,
+                .pad=0,
+                .ts=reinterpret_cast<std::uint64_t>(&ts)
+            };
+            enter(1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+        }
+        return reap(on_ready);
+    }
+
+    std::uint64_t discarded_completions() const noexcept
+    {
+        return m_discarded_completions;
+    }
+
+private:
+    // Resuming an awaiter can reenter reap through abandon, so the head is
+    // reread for every completion instead of being kept across the resume.
+    template <typename Func>
+    int reap(Func&& on_ready)
+    {
+        int n_ready = 0;
+        while (completion_pending()) {
+            unsigned head = *m_cq_head;
+            io_uring_cqe cqe = m_cqes[head & m_cq_mask];
+            std::atomic_ref(*m_cq_head).store(head + 1, std::memory_order_release);
+            if (cqe.user_data == ignored_request) {
+                continue;
+            }
+
+            auto req = m_requests[cqe.user_data];
+            m_free.push_back(cqe.user_data);
+            if (req.result) {
+                *req.result = cqe.res;
+            }
+            if (!req.handle) {
+                discard(req, cqe.res);
+                continue;
+            }
+
+            if (req.poll_fd != -1) {
+                poll_slot(req.poll_fd, req.poll_writer) = no_request;
+            }
+            ++n_ready;
+            on_ready(req.handle);
+        }
+        return n_ready;
+    }
+
+    static int setup(unsigned entries, io_uring_params& params)
+    {
+        params = {};
+        return check_fd(syscall(__NR_io_uring_setup, entries, &params));
+    }
+
+    void* map(std::size_t size, off_t offset)
+    {
+        void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd.get(), offset);
+        if (ptr == MAP_FAILED) {
+            throw std::system_error(errno, std::system_category());
+        }
+        return ptr;
+    }
+
+    // Returns false if the kernel refused the submissions because it still
+    // holds completions that didn't fit in the completion queue.
+    bool enter(unsigned min_complete, unsigned flags, void* arg = nullptr, std::size_t arg_size = 0)
+    {
+        std::atomic_ref(*m_sq_tail).store(m_sq_local_tail, std::memory_order_release);
+        unsigned to_submit = m_sq_local_tail - std::atomic_ref(*m_sq_head).load(std::memory_order_acquire);
+        if (to_submit == 0 && min_complete == 0) {
+            return true;
+        }
+
+        int ret = syscall(__NR_io_uring_enter, m_ring_fd.get(), to_submit, min_complete, flags, arg, arg_size);
+        if (ret == -1 && errno == EBUSY) {
+            return false;
+        }
+        if (ret == -1 && errno != EINTR && errno != ETIME) {
+            throw std::system_error(errno, std::system_category());
+        }
+        return true;
+    }
+
+    // A full submission queue is flushed before the entry is reused, which
+    // can take several attempts: on EBUSY the completion queue is drained
+    // into the ready queue to let the kernel post the rest, and an
+    // interrupted enter is simply retried.
+    io_uring_sqe& next_sqe()
+    {
+        while (m_sq_local_tail - std::atomic_ref(*m_sq_head).load(std::memory_order_acquire) == m_params.sq_entries) {
+            if (enter(0, 0)) {
+                continue;
+            }
+            if (completion_pending()) {
+                reap([](std::coroutine_handle<> handle) {
+                    ready_queue::instance().push(handle);
+                });
+            } else {
+                enter(1, IORING_ENTER_GETEVENTS);
+            }
+        }
+
+        auto& sqe = m_sqes[m_sq_local_tail & m_sq_mask];
+        ++m_sq_local_tail;
+        std::memset(&sqe, 0, sizeof(sqe));
+        return sqe;
+    }
+
+    bool completion_pending() const
+    {
+        return *m_cq_head != std::atomic_ref(*m_cq_tail).load(std::memory_order_acquire);
+    }
+
+    std::uint32_t allocate(request req)
+    {
+        if (m_free.empty()) {
+            m_requests.push_back(req);
+            return m_requests.size() - 1;
+        }
+
+        auto id = m_free.back();
+        m_free.pop_back();
+        m_requests[id] = req;
+        return id;
+    }
+
+    // An operation that completed after its awaiter went away. Accepted
+    // connections are closed rather than leaked; any other result is lost
+    // and only counted.
+    void discard(const request& req, int res)
+    {
+        if (res < 0 || req.poll_fd != -1 || req.opcode == IORING_OP_POLL_ADD) {
+            return;
+        }
+        if (req.opcode == IORING_OP_ACCEPT) {
+            close(res);
+        }
+        ++m_discarded_completions;
+    }
+
+    std::uint32_t& poll_slot(int fd, bool writer)
+    {
+        if (std::size_t(fd) >= m_polls.size()) {
+            m_polls.resize(std::max(std::size_t(fd) + 1, 2 * m_polls.size()));
+        }
+        return writer ? m_polls[fd].writer : m_polls[fd].reader;
+    }
+
+    void add_poll(int fd, bool writer, std::coroutine_handle<> handle)
+    {
+        remove_poll(poll_slot(fd, writer));
+        auto id = allocate(request{handle, nullptr, fd, writer});
+        auto& sqe = next_sqe();
+        sqe.opcode = IORING_OP_POLL_ADD;
+        sqe.fd = fd;
+        sqe.poll32_events = writer ? POLLOUT : POLLIN;
+        sqe.user_data = id;
+        poll_slot(fd, writer) = id;
+    }
+
+    void remove_poll(std::uint32_t& slot)
+    {
+        if (slot != no_request) {
+            auto id = std::exchange(slot, no_request);
+            m_requests[id].handle = {};
+            cancel(id);
+        }
+    }
+
+    io_uring_params m_params;
+    unique_fd m_ring_fd;
+    void* m_sq_ring;
+    void* m_cq_ring;
+    std::size_t m_sq_ring_size;
+    std::size_t m_cq_ring_size;
+    io_uring_sqe* m_sqes;
+    unsigned* m_sq_head;
+    unsigned* m_sq_tail;
+    unsigned m_sq_mask;
+    unsigned m_sq_local_tail;
+    unsigned* m_cq_head;
+    unsigned* m_cq_tail;
+    unsigned m_cq_mask;
+    io_uring_cqe* m_cqes;
+    std::pmr::vector<request> m_requests{loop_resource()};
+    std::pmr::vector<std::uint32_t> m_free{loop_resource()};
+    std::pmr::vector<poll_state> m_polls{loop_resource()};
+    std::uint64_t m_discarded_completions = 0;
+};
+
+}
\ No newline at end of file
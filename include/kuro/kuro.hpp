@@ -1,11 +1,21 @@
 #pragma once
 
 #include "address.hpp"
+#include "arena.hpp"
 #include "cancellation.hpp"
+#include "channel.hpp"
+#include "eager_task.hpp"
 #include "event_loop.hpp"
 #include "event.hpp"
+#include "frame_allocator.hpp"
 #include "gather.hpp"
 #include "mutex.hpp"
+#include "parallel.hpp"
 #include "queuelike.hpp"
+#include "result.hpp"
+#include "run_in_executor.hpp"
+#include "runtime.hpp"
 #include "sleep.hpp"
-#include "socket.hpp"
\ No newline at end of file
+#include "socket.hpp"
+#include "task_group.hpp"
+#include "work_stealing_scheduler.hpp"
\ No newline at end of file
@@ -1,11 +1,14 @@
 #pragma once
 
+#include <concepts>
+#include <memory_resource>
+
 #include "continuation.hpp"
 
 namespace kuro
 {
 
-template <continuation_container Continuation = multi_continuation>
+template <continuation_container Continuation = intrusive_continuation>
 class mutex
 {
     class locked_mutex
@@ -27,6 +30,11 @@ class mutex
     };
 
 public:
+    mutex() = default;
+    explicit mutex(std::pmr::memory_resource* resource)
+        requires std::constructible_from<Continuation, std::pmr::memory_resource*>
+        : m_continuation(resource) {}
+
     auto acquire()
     {
         struct mutex_lock_operation
@@ -38,8 +46,8 @@ public:
             }
             void await_suspend(std::coroutine_handle<> handle) noexcept
             {
-                m_handle = handle;
-                m_mutex->m_continuation.push(handle);
+                m_waiter.handle = handle;
+                detail::push_waiter(m_mutex->m_continuation, m_waiter);
             }
             auto await_resume() const noexcept
             {
@@ -47,12 +55,15 @@ public:
             }
             void await_cancel() noexcept
             {
-                m_mutex->m_continuation.erase(m_handle);
+                if (!detail::erase_waiter(m_mutex->m_continuation, m_waiter)) {
+                    m_waiter.unschedule();
+                    m_mutex->unlock();
+                }
             }
 
         private:
             mutex* m_mutex;
-            std::coroutine_handle<> m_handle;
+            detail::waiter_node m_waiter;
         };
 
         return mutex_lock_operation{this};
@@ -69,8 +80,7 @@ private:
     }
     void unlock()
     {
-        m_locked = false;
-        m_continuation.resume_one();
+        m_locked = m_continuation.resume_one();
     }
 
     Continuation m_continuation;
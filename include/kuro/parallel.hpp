@@ -0,0 +1,260 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <concepts>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <optional>
+#include <ranges>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "event_loop.hpp"
+
+namespace kuro
+{
+
+namespace detail
+{
+
+template <typename Derived, typename Range>
+class parallel_operation : detail::inbox::node
+{
+    struct chunk_job : thread_pool::job
+    {
+        parallel_operation* owner;
+        std::size_t first;
+        std::size_t last;
+    };
+
+public:
+    parallel_operation(Range range, std::size_t chunk) :
+        m_range(std::move(range)),
+        m_chunk(std::max<std::size_t>(chunk, 1)) {}
+    // Only before it is awaited, e.g. into with_timeout, while no worker
+    // references it yet.
+    parallel_operation(parallel_operation&& other) :
+        m_range(std::move(other.m_range)),
+        m_chunk(other.m_chunk) {}
+    // A coroutine destroyed while suspended on it must not leave chunks
+    // running over the range, or the completion referencing the frame. The
+    // running chunks are waited for without spinning, and the completion is
+    // posted right after the last one.
+    ~parallel_operation()
+    {
+        if (!m_loop) {
+            return;
+        }
+
+        m_cancelled.store(true, std::memory_order_relaxed);
+        auto& pool = event_loop::executor();
+        for (auto& job : m_jobs) {
+            if (pool.withdraw(job) && m_remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                return;
+            }
+        }
+        m_finished.wait(false, std::memory_order_acquire);
+        while (!m_loop->withdraw(*this)) {
+            std::this_thread::yield();
+        }
+    }
+
+    bool await_ready() noexcept
+    {
+        return std::ranges::empty(m_range);
+    }
+    void await_suspend(std::coroutine_handle<> handle)
+    {
+        auto size = std::size_t(std::ranges::size(m_range));
+        m_handle = handle;
+        m_remaining.store((size + m_chunk - 1) / m_chunk, std::memory_order_relaxed);
+
+        m_loop = &event_loop::current();
+
+        // One allocation for all the chunks' jobs, and the completion is
+        // posted through the node the operation embeds.
+        m_jobs.reserve((size + m_chunk - 1) / m_chunk);
+        for (std::size_t first = 0; first < size; first += m_chunk) {
+            m_jobs.push_back({{execute}, this, first, std::min(first + m_chunk, size)});
+        }
+        auto& pool = event_loop::executor();
+        for (auto& job : m_jobs) {
+            pool.submit(job);
+        }
+    }
+
+    // The running chunks still reference the range, so the awaiter is only
+    // resumed once they have finished. Chunks that haven't started are
+    // skipped.
+    bool await_cancel() noexcept
+    {
+        m_cancelled.store(true, std::memory_order_relaxed);
+        return false;
+    }
+    // Only if a chunk was skipped, otherwise the result is complete.
+    bool await_cancelled() const noexcept
+    {
+        return m_skipped.load(std::memory_order_relaxed);
+    }
+
+protected:
+    void rethrow_exception() const
+    {
+        if (m_exception) {
+            std::rethrow_exception(m_exception);
+        }
+    }
+
+    Range m_range;
+
+private:
+    static void execute(thread_pool::job& job)
+    {
+        auto& chunk = static_cast<chunk_job&>(job);
+        auto self = chunk.owner;
+        self->run_chunk(chunk.first, chunk.last);
+        if (self->m_remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            auto loop = self->m_loop;
+            self->m_finished.store(true, std::memory_order_release);
+            self->m_finished.notify_one();
+            loop->post(static_cast<detail::inbox::node&>(*self));
+        }
+    }
+    void run() override
+    {
+        m_loop = nullptr;
+        m_handle.resume();
+    }
+    void run_chunk(std::size_t first, std::size_t last)
+    {
+        if (m_failed.load(std::memory_order_relaxed)) {
+            return;
+        }
+        if (m_cancelled.load(std::memory_order_relaxed)) {
+            m_skipped.store(true, std::memory_order_relaxed);
+            return;
+        }
+
+        try {
+            auto it = std::ranges::begin(m_range);
+            for (auto i = first; i < last; ++i) {
+                static_cast<Derived*>(this)->apply(i, it[i]);
+            }
+        } catch (...) {
+            if (!m_failed.exchange(true, std::memory_order_relaxed)) {
+                m_exception = std::current_exception();
+            }
+        }
+    }
+
+    std::size_t m_chunk;
+    std::vector<chunk_job> m_jobs;
+    event_loop* m_loop = nullptr;
+    std::coroutine_handle<> m_handle;
+    std::atomic<std::size_t> m_remaining = 0;
+    std::atomic<bool> m_failed = false;
+    std::atomic<bool> m_cancelled = false;
+    std::atomic<bool> m_skipped = false;
+    std::atomic<bool> m_finished = false;
+    std::exception_ptr m_exception;
+};
+
+template <typename Range, typename Func>
+class parallel_for_awaitable : public parallel_operation<parallel_for_awaitable<Range, Func>, Range>
+{
+    friend parallel_operation<parallel_for_awaitable, Range>;
+
+public:
+    parallel_for_awaitable(Range range, std::size_t chunk, Func func) :
+        parallel_for_awaitable::parallel_operation(std::move(range), chunk),
+        m_func(std::move(func)) {}
+
+    void await_resume() const
+    {
+        this->rethrow_exception();
+    }
+
+private:
+    template <typename T>
+    void apply(std::size_t, T&& item)
+    {
+        std::invoke(m_func, std::forward<T>(item));
+    }
+
+    Func m_func;
+};
+
+template <typename Range, typename Func>
+class parallel_transform_awaitable : public parallel_operation<parallel_transform_awaitable<Range, Func>, Range>
+{
+    friend parallel_operation<parallel_transform_awaitable, Range>;
+
+    using result_t = std::remove_cvref_t<std::invoke_result_t<Func&, std::ranges::range_reference_t<Range>>>;
+    // Results are written in place and the vector is returned as is, unless
+    // they can't be default constructed, or would share bits in a
+    // std::vector<bool> written to from several threads.
+    static constexpr bool in_place = std::default_initializable<result_t> && !std::same_as<result_t, bool>;
+    using slot_t = std::conditional_t<in_place, result_t, std::optional<result_t>>;
+
+public:
+    parallel_transform_awaitable(Range range, std::size_t chunk, Func func) :
+        parallel_transform_awaitable::parallel_operation(std::move(range), chunk),
+        m_func(std::move(func)),
+        m_results(std::ranges::size(this->m_range)) {}
+
+    std::vector<result_t> await_resume()
+    {
+        this->rethrow_exception();
+        if constexpr (in_place) {
+            return std::move(m_results);
+        } else {
+            std::vector<result_t> results;
+            results.reserve(m_results.size());
+            for (auto& r : m_results) {
+                results.push_back(std::move(*r));
+            }
+            return results;
+        }
+    }
+
+private:
+    template <typename T>
+    void apply(std::size_t i, T&& item)
+    {
+        if constexpr (in_place) {
+            m_results[i] = std::invoke(m_func, std::forward<T>(item));
+        } else {
+            m_results[i].emplace(std::invoke(m_func, std::forward<T>(item)));
+        }
+    }
+
+    Func m_func;
+    std::vector<slot_t> m_results;
+};
+
+}
+
+template <std::ranges::random_access_range Range, typename Func>
+    requires std::ranges::sized_range<Range>
+auto parallel_for(Range&& range, std::size_t chunk, Func&& func)
+{
+    using view_t = std::views::all_t<Range>;
+    return detail::parallel_for_awaitable<view_t, std::decay_t<Func>>(
+        std::views::all(std::forward<Range>(range)), chunk, std::forward<Func>(func));
+}
+
+template <std::ranges::random_access_range Range, typename Func>
+    requires std::ranges::sized_range<Range>
+auto parallel_transform(Range&& range, std::size_t chunk, Func&& func)
+{
+    using view_t = std::views::all_t<Range>;
+    return detail::parallel_transform_awaitable<view_t, std::decay_t<Func>>(
+        std::views::all(std::forward<Range>(range)), chunk, std::forward<Func>(func));
+}
+
+}
\ No newline at end of file
@@ -4,11 +4,13 @@
 #include <exception>
 #include <type_traits>
 
+#include "frame_allocator.hpp"
+
 namespace kuro::detail
 {
 
 template <typename T>
-class return_value_promise
+class return_value_promise : public pooled_frame
 {
     enum class promise_state
     {
@@ -29,9 +31,13 @@ public:
     }
     void unhandled_exception()
     {
-        m_except = std::current_exception();
+        new(&m_except) std::exception_ptr(std::current_exception());
         m_state = promise_state::exception;
     }
+    bool has_exception() const noexcept
+    {
+        return m_state == promise_state::exception;
+    }
 
 protected:
     T& get_data()
@@ -101,7 +107,7 @@ public:
     }
 };
 
-class void_promise
+class void_promise : public pooled_frame
 {
 public:
     void result() const
@@ -115,6 +121,10 @@ public:
     {
         m_except = std::current_exception();
     }
+    bool has_exception() const noexcept
+    {
+        return m_except != nullptr;
+    }
 
 private:
     std::exception_ptr m_except = nullptr;
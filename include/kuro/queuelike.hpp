@@ -1,78 +1,135 @@
 #pragma once
 
+#include <concepts>
+#include <deque>
+#include <memory>
+#include <memory_resource>
 #include <queue>
 #include <stack>
+#include <utility>
+#include <vector>
 
 #include "continuation.hpp"
 
 namespace kuro
 {
 
-template <typename Container, continuation_container Continuation = multi_continuation>
+template <typename Container, continuation_container Continuation = intrusive_continuation>
 class queuelike
 {
+protected:
     using T = Container::value_type;
 
+    class pop_operation
+    {
+    public:
+        pop_operation(queuelike* q) : m_queuelike(q) {}
+        bool await_ready() const noexcept
+        {
+            return !m_queuelike->empty();
+        }
+        void await_suspend(std::coroutine_handle<> handle) noexcept
+        {
+            m_waiter.handle = handle;
+            detail::push_waiter(m_queuelike->m_continuation, m_waiter);
+        }
+        T await_resume() noexcept
+        {
+            if (m_waiter.handle) {
+                m_queuelike->m_reserved--;
+            }
+            return m_queuelike->take();
+        }
+        void await_cancel() noexcept
+        {
+            if (!detail::erase_waiter(m_queuelike->m_continuation, m_waiter)) {
+                m_waiter.unschedule();
+                m_queuelike->m_reserved--;
+                m_queuelike->wake_one();
+            }
+        }
+
+    protected:
+        queuelike* m_queuelike;
+        detail::waiter_node m_waiter;
+    };
+
 public:
+    queuelike() = default;
+    explicit queuelike(std::pmr::memory_resource* resource) :
+        m_queue(make_container(resource)),
+        m_continuation(make_continuation(resource)) {}
+
     void push(const T& value)
     {
         m_queue.push(value);
-        m_continuation.resume_one();
+        wake_one();
     }
     void push(T&& value)
     {
         m_queue.push(std::move(value));
-        m_continuation.resume_one();
+        wake_one();
     }
     bool empty() const
     {
-        return m_queue.empty();
+        return m_queue.size() <= m_reserved;
     }
     auto pop()
     {
-        struct pop_operation
-        {
-            pop_operation(queuelike* q) : m_queuelike(q) {}
-            bool await_ready() const noexcept
-            {
-                return !m_queuelike->empty();
-            }
-            void await_suspend(std::coroutine_handle<> handle) noexcept
-            {
-                m_handle = handle;
-                m_queuelike->m_continuation.push(handle);
-            }
-            T await_resume() noexcept
-            {
-                constexpr bool has_top = requires(Container c) { c.top(); };
-
-                if constexpr (has_top) {
-                    T value = std::move(m_queuelike->m_queue.top());
-                    m_queuelike->m_queue.pop();
-                    return value;
-                } else {
-                    T value = std::move(m_queuelike->m_queue.front());
-                    m_queuelike->m_queue.pop();
-                    return value;
-                }
-                
-            }
-            void await_cancel() noexcept
-            {
-                m_queuelike->m_continuation.erase(m_handle);
-            }
-        
-        private:
-            queuelike* m_queuelike;
-            std::coroutine_handle<> m_handle;
-        };
-
         return pop_operation{this};
     }
 
-private:
+protected:
+    // For containers taking constructor arguments, which are followed by
+    // the memory resource.
+    template <typename... Args>
+    queuelike(std::in_place_t, std::pmr::memory_resource* resource, Args&&... args) :
+        m_queue(std::forward<Args>(args)..., resource),
+        m_continuation(make_continuation(resource)) {}
+
+    static Continuation make_continuation(std::pmr::memory_resource* resource)
+    {
+        if constexpr (std::constructible_from<Continuation, std::pmr::memory_resource*>) {
+            return Continuation(resource);
+        } else {
+            return Continuation();
+        }
+    }
+
+    T take()
+    {
+        constexpr bool has_top = requires(Container c) { c.top(); };
+
+        if constexpr (has_top) {
+            T value = std::move(m_queue.top());
+            m_queue.pop();
+            return value;
+        } else {
+            T value = std::move(m_queue.front());
+            m_queue.pop();
+            return value;
+        }
+    }
+    void wake_one()
+    {
+        if (m_queue.size() > m_reserved && m_continuation.resume_one()) {
+            m_reserved++;
+        }
+    }
+
     Container m_queue;
     Continuation m_continuation;
+    std::size_t m_reserved = 0;
+
+private:
+    static Container make_container(std::pmr::memory_resource* resource)
+    {
+        if constexpr (std::uses_allocator_v<Container, std::pmr::polymorphic_allocator<T>>) {
+            return Container(std::pmr::polymorphic_allocator<T>(resource));
+        } else {
+            return Container();
+        }
+    }
 };
 
 template <std::movable T>
@@ -84,4 +141,18 @@ using stack = queuelike<std::stack<T>>;
 template <std::movable T>
 using priority_queue = queuelike<std::priority_queue<T>>;
 
+namespace pmr
+{
+
+template <std::movable T>
+using queue = queuelike<std::queue<T, std::pmr::deque<T>>>;
+
+template <std::movable T>
+using stack = queuelike<std::stack<T, std::pmr::deque<T>>>;
+
+template <std::movable T>
+using priority_queue = queuelike<std::priority_queue<T, std::pmr::vector<T>>>;
+
+}
+
 }
\ No newline at end of file
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <coroutine>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory_resource>
+#include <utility>
+#include <vector>
+
+namespace kuro::detail
+{
+
+// The memory resource for the event loop state of the calling thread, see
+// event_loop::set_memory_resource.
+inline std::pmr::memory_resource*& loop_resource() noexcept
+{
+    static thread_local std::pmr::memory_resource* resource = std::pmr::get_default_resource();
+    return resource;
+}
+
+// Entries are numbered in the order they are pushed, and push returns the
+// number as a ticket, which erase takes to clear the entry in O(1).
+class ready_queue
+{
+    struct entry
+    {
+        std::coroutine_handle<> handle;
+        void (*function)(void*) = nullptr;
+        void* context = nullptr;
+        std::function<void()> callback;
+    };
+
+public:
+    // Never 0, which callers can use for no ticket.
+    using ticket = std::uint64_t;
+
+    ready_queue(const ready_queue&) = delete;
+    ready_queue& operator=(const ready_queue&) = delete;
+
+    static ready_queue& instance()
+    {
+        static thread_local ready_queue inst;
+        return inst;
+    }
+
+    ticket push(std::coroutine_handle<> handle)
+    {
+        m_pending.push_back({handle, nullptr, nullptr, {}});
+        return m_pending_first + m_pending.size() - 1;
+    }
+    // Runs function(context), without allocating like a std::function may.
+    ticket push(void (*function)(void*), void* context)
+    {
+        m_pending.push_back({nullptr, function, context, {}});
+        return m_pending_first + m_pending.size() - 1;
+    }
+    ticket push(std::function<void()> callback)
+    {
+        m_pending.push_back({nullptr, nullptr, nullptr, std::move(callback)});
+        return m_pending_first + m_pending.size() - 1;
+    }
+    // Returns false if the entry already ran, or was erased.
+    bool erase(ticket t)
+    {
+        if (t >= m_pending_first) {
+            return t - m_pending_first < m_pending.size() && clear(m_pending[t - m_pending_first]);
+        }
+        return t >= m_running_first + m_position && t - m_running_first < m_running.size() &&
+            clear(m_running[t - m_running_first]);
+    }
+    // For handles pushed without keeping the ticket, which takes a scan.
+    bool erase(std::coroutine_handle<> handle)
+    {
+        for (auto i = m_position; i < m_running.size(); ++i) {
+            if (m_running[i].handle == handle) {
+                return clear(m_running[i]);
+            }
+        }
+        for (auto& e : m_pending) {
+            if (e.handle == handle) {
+                return clear(e);
+            }
+        }
+        return false;
+    }
+    bool empty() const
+    {
+        return m_pending.empty();
+    }
+    // Drops what is left when the loop stops, so that a later run doesn't
+    // resume frames that may be gone by then. The tickets stay invalid.
+    void clear() noexcept
+    {
+        m_pending_first += m_pending.size();
+        m_pending.clear();
+    }
+    static bool constructed() noexcept
+    {
+        return m_constructed;
+    }
+
+    void run_batch()
+    {
+        std::swap(m_running, m_pending);
+        m_running_first = std::exchange(m_pending_first, m_pending_first + m_running.size());
+        try {
+            for (m_position = 0; m_position < m_running.size(); ) {
+                auto e = std::move(m_running[m_position++]);
+                if (e.handle) {
+                    e.handle.resume();
+                } else if (e.function) {
+                    e.function(e.context);
+                } else if (e.callback) {
+                    e.callback();
+                }
+            }
+        } catch (...) {
+            m_pending.insert(
+                m_pending.begin(),
+                std::make_move_iterator(m_running.begin() + m_position),
+                std::make_move_iterator(m_running.end())
+            );
+            m_pending_first = m_running_first + m_position;
+            m_running.clear();
+            m_position = 0;
+            throw;
+        }
+        m_running.clear();
+        m_position = 0;
+    }
+
+private:
+    static bool clear(entry& e) noexcept
+    {
+        bool queued = e.handle || e.function || e.callback;
+        e.handle = nullptr;
+        e.function = nullptr;
+        e.callback = nullptr;
+        return queued;
+    }
+
+    ready_queue() : m_pending(loop_resource()), m_running(loop_resource())
+    {
+        m_constructed = true;
+    }
+
+    std::pmr::vector<entry> m_pending;
+    std::pmr::vector<entry> m_running;
+    std::size_t m_position = 0;
+    ticket m_pending_first = 1;
+    ticket m_running_first = 1;
+
+    static inline thread_local bool m_constructed = false;
+};
+
+}
\ No newline at end of file
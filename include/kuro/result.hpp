@@ -0,0 +1,154 @@
+#pragma once
+
+#include <coroutine>
+#include <optional>
+#include <type_traits>
+#include <system_error>
+#include <utility>
+
+namespace kuro
+{
+
+// Either a value or an error code. Unlike a thrown std::system_error, an
+// error carried in a result travels through co_await without unwinding.
+template <typename T>
+class result
+{
+public:
+    result(T value) : m_value(std::move(value)) {}
+    result(std::error_code error) : m_error(error) {}
+
+    bool has_value() const noexcept
+    {
+        return m_value.has_value();
+    }
+    explicit operator bool() const noexcept
+    {
+        return has_value();
+    }
+    T& value() &
+    {
+        check();
+        return *m_value;
+    }
+    T&& value() &&
+    {
+        check();
+        return std::move(*m_value);
+    }
+    template <typename U>
+    T value_or(U&& fallback) &&
+    {
+        return has_value() ? std::move(*m_value) : T(std::forward<U>(fallback));
+    }
+    std::error_code error() const noexcept
+    {
+        return m_error;
+    }
+
+    T& operator*() & noexcept
+    {
+        return *m_value;
+    }
+    T&& operator*() && noexcept
+    {
+        return std::move(*m_value);
+    }
+    T* operator->() noexcept
+    {
+        return &*m_value;
+    }
+
+private:
+    void check() const
+    {
+        if (!has_value()) {
+            throw std::system_error(m_error);
+        }
+    }
+
+    std::optional<T> m_value;
+    std::error_code m_error;
+};
+
+template <>
+class result<void>
+{
+public:
+    result() = default;
+    result(std::error_code error) : m_error(error) {}
+
+    bool has_value() const noexcept
+    {
+        return !m_error;
+    }
+    explicit operator bool() const noexcept
+    {
+        return has_value();
+    }
+    void value() const
+    {
+        if (m_error) {
+            throw std::system_error(m_error);
+        }
+    }
+    std::error_code error() const noexcept
+    {
+        return m_error;
+    }
+
+private:
+    std::error_code m_error;
+};
+
+namespace detail
+{
+
+template <typename T>
+concept result_resumable = requires(T a) { a.try_resume(); };
+
+template <result_resumable Awaitable>
+class result_awaitable
+{
+public:
+    result_awaitable(Awaitable awaitable) : m_awaitable(std::move(awaitable)) {}
+
+    bool await_ready()
+    {
+        return m_awaitable.await_ready();
+    }
+    decltype(auto) await_suspend(std::coroutine_handle<> handle)
+    {
+        return m_awaitable.await_suspend(handle);
+    }
+    auto await_resume()
+    {
+        return m_awaitable.try_resume();
+    }
+    auto await_cancel()
+        requires requires(Awaitable a) { a.await_cancel(); }
+    {
+        return m_awaitable.await_cancel();
+    }
+    bool await_cancelled()
+        requires requires(Awaitable a) { a.await_cancelled(); }
+    {
+        return m_awaitable.await_cancelled();
+    }
+
+private:
+    Awaitable m_awaitable;
+};
+
+}
+
+// Adapts an I/O operation so that a failed system call is returned as a
+// result holding its error code, instead of being reported through errno
+// or a thrown std::system_error.
+template <detail::result_resumable Awaitable>
+auto as_result(Awaitable&& awaitable)
+{
+    return detail::result_awaitable<std::remove_cvref_t<Awaitable>>(std::forward<Awaitable>(awaitable));
+}
+
+}
\ No newline at end of file
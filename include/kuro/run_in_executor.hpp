@@ -0,0 +1,122 @@
+#pragma once
+
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#include "event_loop.hpp"
+#include "util.hpp"
+
+namespace kuro
+{
+
+template <typename Func>
+auto run_in_executor(Func&& func)
+{
+    using result_t = std::remove_cvref_t<std::invoke_result_t<std::decay_t<Func>&>>;
+
+    // The job and its completion are nodes embedded in the awaitable, so an
+    // offloaded call doesn't allocate.
+    class awaitable : detail::thread_pool::job, detail::inbox::node
+    {
+    public:
+        awaitable(Func&& func) : job{execute}, m_func(std::forward<Func>(func)) {}
+        // Only before it is awaited, e.g. into with_timeout.
+        awaitable(awaitable&& other) : job{execute}, m_func(std::move(other.m_func)) {}
+        // A coroutine destroyed while suspended on it must not leave the job
+        // or its completion referencing the frame. A running function is
+        // waited for without spinning, and its completion is posted right
+        // after it has finished.
+        ~awaitable()
+        {
+            if (m_loop && !event_loop::executor().withdraw(*this)) {
+                m_finished.wait(false, std::memory_order_acquire);
+                while (!m_loop->withdraw(*this)) {
+                    std::this_thread::yield();
+                }
+            }
+        }
+
+        bool await_ready() const noexcept
+        {
+            return false;
+        }
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+            m_handle = handle;
+            m_loop = &event_loop::current();
+            event_loop::executor().submit(*this);
+        }
+        result_t await_resume()
+        {
+            if (m_exception) {
+                std::rethrow_exception(m_exception);
+            }
+            if constexpr (!std::is_void_v<result_t>) {
+                return std::move(*m_result);
+            }
+        }
+        // A function that is still queued is withdrawn, one that has started
+        // runs to completion first.
+        bool await_cancel() noexcept
+        {
+            if (event_loop::executor().withdraw(*this)) {
+                m_loop = nullptr;
+                m_skipped = true;
+                return true;
+            }
+            m_cancelled.store(true, std::memory_order_relaxed);
+            return false;
+        }
+        bool await_cancelled() const noexcept
+        {
+            return m_skipped;
+        }
+
+    private:
+        static void execute(detail::thread_pool::job& job)
+        {
+            auto& self = static_cast<awaitable&>(job);
+            if (self.m_cancelled.load(std::memory_order_relaxed)) {
+                self.m_skipped = true;
+            } else {
+                try {
+                    if constexpr (std::is_void_v<result_t>) {
+                        self.m_func();
+                        self.m_result.emplace();
+                    } else {
+                        self.m_result.emplace(self.m_func());
+                    }
+                } catch (...) {
+                    self.m_exception = std::current_exception();
+                }
+            }
+            auto loop = self.m_loop;
+            self.m_finished.store(true, std::memory_order_release);
+            self.m_finished.notify_one();
+            loop->post(static_cast<detail::inbox::node&>(self));
+        }
+        void run() override
+        {
+            m_loop = nullptr;
+            m_handle.resume();
+        }
+
+        std::decay_t<Func> m_func;
+        std::optional<std::conditional_t<std::is_void_v<result_t>, void_t, result_t>> m_result;
+        std::exception_ptr m_exception;
+        std::atomic<bool> m_cancelled = false;
+        std::atomic<bool> m_finished = false;
+        bool m_skipped = false;
+        std::coroutine_handle<> m_handle;
+        event_loop* m_loop = nullptr;
+    };
+
+    return awaitable(std::forward<Func>(func));
+}
+
+}
\ No newline at end of file
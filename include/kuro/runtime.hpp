@@ -0,0 +1,120 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "cancellation.hpp"
+#include "event_loop.hpp"
+#include "task.hpp"
+#include "with_cancellation.hpp"
+
+namespace kuro
+{
+
+class runtime
+{
+public:
+    explicit runtime(std::size_t n_threads = std::max(1u, std::thread::hardware_concurrency())) : m_size(n_threads) {}
+
+    std::size_t size() const noexcept
+    {
+        return m_size;
+    }
+
+    template <typename Func>
+    auto run(Func&& factory)
+    {
+        using result_t = decltype(event_loop::run(make_task(factory, 0)));
+        using slot_t = std::conditional_t<std::is_void_v<result_t>, std::monostate, std::optional<result_t>>;
+
+        std::vector<slot_t> results(m_size);
+        std::exception_ptr failure;
+        std::mutex mutex;
+        std::vector<cancellation> stops(m_size);
+        std::vector<cancellation*> running(m_size, nullptr);
+        {
+            std::vector<std::jthread> threads;
+            threads.reserve(m_size);
+            for (std::size_t shard = 0; shard < m_size; ++shard) {
+                threads.emplace_back([&, shard] {
+                    {
+                        std::lock_guard lock(mutex);
+                        if (failure) {
+                            return;
+                        }
+                        running[shard] = &stops[shard];
+                    }
+                    try {
+                        auto result = event_loop::run(stoppable(make_task(factory, shard), stops[shard]));
+                        if constexpr (!std::is_void_v<result_t>) {
+                            if (result) {
+                                results[shard].emplace(std::move(*result));
+                            }
+                        }
+                    } catch (...) {
+                        std::lock_guard lock(mutex);
+                        if (!failure) {
+                            failure = std::current_exception();
+                            stop_all(running, shard);
+                        }
+                    }
+                    std::lock_guard lock(mutex);
+                    running[shard] = nullptr;
+                });
+            }
+        }
+
+        if (failure) {
+            std::rethrow_exception(failure);
+        }
+
+        if constexpr (!std::is_void_v<result_t>) {
+            std::vector<result_t> out;
+            out.reserve(m_size);
+            for (auto& r : results) {
+                out.push_back(std::move(*r));
+            }
+            return out;
+        }
+    }
+
+private:
+    // Cancels the other shards' root tasks, which unwind like any cancelled
+    // task, so that their loops are left with nothing pending.
+    static void stop_all(const std::vector<cancellation*>& running, std::size_t failed)
+    {
+        for (std::size_t shard = 0; shard < running.size(); ++shard) {
+            if (running[shard] && shard != failed) {
+                running[shard]->trigger();
+            }
+        }
+    }
+
+    template <typename T>
+    static task<std::optional<detail::non_void_awaited_t<task<T>>>> stoppable(task<T> root_task, cancellation& stop)
+    {
+        co_return co_await with_cancellation(std::move(root_task), stop);
+    }
+
+    template <typename Func>
+    static auto make_task(Func& factory, std::size_t shard)
+    {
+        if constexpr (std::is_invocable_v<Func&, std::size_t>) {
+            return factory(shard);
+        } else {
+            return factory();
+        }
+    }
+
+    std::size_t m_size;
+};
+
+}
\ No newline at end of file
@@ -7,6 +7,7 @@
 #include <vector>
 
 #include "promise.hpp"
+#include "ready_queue.hpp"
 
 namespace kuro
 {
@@ -38,10 +39,11 @@ public:
                 {
                     auto& continuation = handle.promise().m_continuation;
                     if (!continuation.empty()) {
-                        for (auto i = 0UL; i < continuation.size() - 1; ++i) {
-                            continuation[i].resume();
+                        auto& ready = detail::ready_queue::instance();
+                        for (auto i = 1UL; i < continuation.size(); ++i) {
+                            ready.push(continuation[i]);
                         }
-                        return continuation.back();
+                        return continuation.front();
                     }
 
                     return std::noop_coroutine();
@@ -2,12 +2,12 @@
 
 #include <chrono>
 #include <coroutine>
+#include <utility>
 
-#include <sys/timerfd.h>
-#include <unistd.h>
+#include <time.h>
 
 #include "event_loop.hpp"
-#include "unique_fd.hpp"
+#include "timer_wheel.hpp"
 
 namespace kuro
 {
@@ -36,35 +36,95 @@ public:
     {
         return timespec{.tv_sec=m_sec, .tv_nsec=m_nanosec};
     }
+    explicit operator std::chrono::nanoseconds() const
+    {
+        return std::chrono::seconds(m_sec) + std::chrono::nanoseconds(m_nanosec);
+    }
 
 private:
     long m_sec;
     long m_nanosec;
 };
 
-class sleep_for
+class sleep_until
 {
 public:
-    sleep_for(duration d) : m_fd(timerfd_create(CLOCK_MONOTONIC, 0)), m_time(static_cast<timespec>(d)) {}
+    sleep_until(std::chrono::steady_clock::time_point deadline) : m_deadline(deadline) {}
+    std::chrono::steady_clock::time_point deadline() const noexcept
+    {
+        return m_deadline;
+    }
     bool await_ready() const noexcept
     {
-        return m_time.tv_sec < 0 || (m_time.tv_sec == 0 && m_time.tv_nsec == 0);
+        return m_deadline <= std::chrono::steady_clock::now();
     }
     void await_resume() const noexcept {}
-    void await_suspend(std::coroutine_handle<> handle) noexcept
+    void await_suspend(std::coroutine_handle<> handle)
     {
-        itimerspec tspec{.it_value=m_time};
-        timerfd_settime(m_fd.get(), 0, &tspec, nullptr);
-        event_loop::add_reader(m_fd.get(), handle);
+        m_timer.handle = handle;
+        event_loop::add_timer(m_timer, m_deadline);
     }
     void await_cancel() noexcept
     {
-        event_loop::remove_fd(m_fd.get());
+        m_timer.cancel();
     }
 
 private:
-    detail::unique_fd m_fd;
-    timespec m_time;
+    struct resume_timer : detail::timer_node
+    {
+        resume_timer() : detail::timer_node(fire) {}
+        static void fire(detail::timer_node& node)
+        {
+            static_cast<resume_timer&>(node).handle.resume();
+        }
+
+        std::coroutine_handle<> handle;
+    };
+
+    std::chrono::steady_clock::time_point m_deadline;
+    resume_timer m_timer;
 };
 
+class sleep_for : public sleep_until
+{
+public:
+    sleep_for(duration d) : sleep_until(std::chrono::steady_clock::now() + static_cast<std::chrono::nanoseconds>(d)) {}
+};
+
+// Lets the other ready coroutines, and the IO poll, run before continuing.
+inline auto yield()
+{
+    struct awaitable
+    {
+        awaitable() = default;
+        awaitable(awaitable&& other) noexcept : m_ticket(std::exchange(other.m_ticket, 0)) {}
+        awaitable& operator=(awaitable&&) = delete;
+        // A frame destroyed while it is yielded must not stay in the queue.
+        ~awaitable()
+        {
+            if (m_ticket) {
+                detail::ready_queue::instance().erase(m_ticket);
+            }
+        }
+
+        bool await_ready() const noexcept
+        {
+            return false;
+        }
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+            m_ticket = detail::ready_queue::instance().push(handle);
+        }
+        void await_resume() const noexcept {}
+        void await_cancel() noexcept
+        {
+            detail::ready_queue::instance().erase(m_ticket);
+        }
+
+        detail::ready_queue::ticket m_ticket = 0;
+    };
+
+    return awaitable{};
+}
+
 }
\ No newline at end of file
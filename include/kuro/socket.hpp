@@ -1,7 +1,11 @@
 #pragma once
 
+#include <chrono>
 #include <coroutine>
+#include <cstdint>
+#include <memory>
 #include <optional>
+#include <type_traits>
 
 #include <netinet/in.h>
 #include <sys/socket.h>
@@ -9,9 +13,11 @@
 #include <unistd.h>
 
 #include "address.hpp"
+#include "arena.hpp"
 #include "cancellation.hpp"
 #include "error.hpp"
 #include "event_loop.hpp"
+#include "io_operation.hpp"
 #include "task.hpp"
 #include "task_executor.hpp"
 #include "unique_fd.hpp"
@@ -30,45 +36,48 @@ protected:
     template <typename T>
     auto base_connect(T addr)
     {
-        struct connect_awaitable
+        struct connect_awaitable : detail::io_operation<connect_awaitable, detail::io_direction::write>
         {
-            connect_awaitable(T addr, int fd) : m_addr(addr), m_fd(fd) {}
-            bool await_ready()
+            connect_awaitable(T addr, int fd) : connect_awaitable::io_operation(fd), m_addr(addr) {}
+            int start()
             {
-                int ret = ::connect(m_fd, reinterpret_cast<sockaddr*>(&m_addr), sizeof(m_addr));
-                if (ret == 0) {
-                    m_success = true;
-                    return true;
-                } else if (errno == EINPROGRESS) {
-                    return false;
-                } else {
-                    throw std::system_error(errno, std::system_category());
+                int ret = ::connect(this->m_fd, reinterpret_cast<sockaddr*>(&m_addr), sizeof(m_addr));
+                if (ret == -1 && errno == EINPROGRESS) {
+                    return -EAGAIN;
                 }
+                // A unix socket whose listener's backlog is full isn't
+                // connecting, and is retried once it is writable instead.
+                m_retry = ret == -1 && errno == EAGAIN;
+                m_failed = ret == -1 && !m_retry;
+                return detail::to_result(ret);
             }
-            void await_suspend(std::coroutine_handle<> handle) const
+            int perform()
             {
-                event_loop::add_writer(m_fd, handle);
-            }
-            int await_resume() const
-            {
-                if (m_success) {
-                    return 0;
+                if (m_retry) {
+                    int ret = ::connect(this->m_fd, reinterpret_cast<sockaddr*>(&m_addr), sizeof(m_addr));
+                    m_failed = ret == -1;
+                    return detail::to_result(ret);
                 }
 
                 int error_code;
                 socklen_t size = sizeof(int);
-                detail::check_error(getsockopt(m_fd, SOL_SOCKET, SO_ERROR, &error_code, &size));
-                return error_code;
+                detail::check_error(getsockopt(this->m_fd, SOL_SOCKET, SO_ERROR, &error_code, &size));
+                return -error_code;
             }
-            void await_cancel() const
+            // Only a connect that is still in progress reports its error as
+            // the result, one that fails immediately throws.
+            int complete(ssize_t result) const
             {
-                event_loop::remove_fd(m_fd);
+                if (m_failed) {
+                    throw std::system_error(static_cast<int>(-result), std::system_category());
+                }
+                return static_cast<int>(-result);
             }
 
         private:
             T m_addr;
-            int m_fd;
-            bool m_success = false;
+            bool m_failed = false;
+            bool m_retry = false;
         };
 
         return connect_awaitable(addr, m_fd.get());
@@ -77,28 +86,31 @@ protected:
     template <typename T>
     auto base_sendto(const void* buf, size_t len, T addr)
     {
-        struct sendto_awaitable
+        struct sendto_awaitable : detail::io_operation<sendto_awaitable, detail::io_direction::write>
         {
-            sendto_awaitable(int fd, const void* buf, size_t len, T addr) : m_fd(fd), m_buf(buf), m_len(len), m_addr(addr) {}
-            bool await_ready() const noexcept { return false; }
-            void await_suspend(std::coroutine_handle<> handle) const
+            sendto_awaitable(int fd, const void* buf, size_t len, T addr) : 
+                sendto_awaitable::io_operation(fd), m_iov{const_cast<void*>(buf), len}, m_addr(addr) {}
+            ssize_t perform()
             {
-                event_loop::add_writer(m_fd, handle);
+                return detail::to_result(::sendto(this->m_fd, m_iov.iov_base, m_iov.iov_len, 0, reinterpret_cast<sockaddr*>(&m_addr), sizeof(m_addr)));
             }
-            ssize_t await_resume()
+            void prepare(io_uring_sqe& sqe)
             {
-                return ::sendto(m_fd, m_buf, m_len, 0, reinterpret_cast<sockaddr*>(&m_addr), sizeof(m_addr));
+                m_hdr = msghdr{&m_addr, sizeof(m_addr), &m_iov, 1, nullptr, 0, 0};
+                sqe.opcode = IORING_OP_SENDMSG;
+                sqe.fd = this->m_fd;
+                sqe.addr = reinterpret_cast<std::uint64_t>(&m_hdr);
+                sqe.len = 1;
             }
-            void await_cancel() const
+            ssize_t complete(ssize_t result) const
             {
-                event_loop::remove_fd(m_fd);
+                return detail::from_result(result);
             }
 
         private:
-            int m_fd;
-            const void* m_buf;
-            size_t m_len;
+            iovec m_iov;
             T m_addr;
+            msghdr m_hdr;
         };
 
         return sendto_awaitable(m_fd.get(), buf, len, addr);
@@ -107,30 +119,31 @@ protected:
     template <typename T>
     auto base_recvfrom(void* buf, size_t len)
     {
-        struct recvfrom_awaitable
+        struct recvfrom_awaitable : detail::io_operation<recvfrom_awaitable, detail::io_direction::read>
         {
-            recvfrom_awaitable(int fd, void* buf, size_t len) : m_fd(fd), m_buf(buf), m_len(len) {}
-            bool await_ready() const noexcept { return false; }
-            void await_suspend(std::coroutine_handle<> handle) const
+            recvfrom_awaitable(int fd, void* buf, size_t len) : recvfrom_awaitable::io_operation(fd), m_iov{buf, len} {}
+            ssize_t perform()
             {
-                event_loop::add_reader(m_fd, handle);
+                socklen_t len = sizeof(T);
+                return detail::to_result(::recvfrom(this->m_fd, m_iov.iov_base, m_iov.iov_len, 0, reinterpret_cast<sockaddr*>(&m_addr), &len));
             }
-            auto await_resume()
+            void prepare(io_uring_sqe& sqe)
             {
-                T s_addr;
-                socklen_t len = sizeof(T);
-                auto n_bytes = ::recvfrom(m_fd, m_buf, m_len, 0, reinterpret_cast<sockaddr*>(&s_addr), &len);
-                return std::pair(n_bytes, detail::from_sockaddr(s_addr));
+                m_hdr = msghdr{&m_addr, sizeof(m_addr), &m_iov, 1, nullptr, 0, 0};
+                sqe.opcode = IORING_OP_RECVMSG;
+                sqe.fd = this->m_fd;
+                sqe.addr = reinterpret_cast<std::uint64_t>(&m_hdr);
+                sqe.len = 1;
             }
-            void await_cancel() const
+            auto complete(ssize_t result)
             {
-                event_loop::remove_fd(m_fd);
+                return std::pair(detail::from_result(result), detail::from_sockaddr(m_addr));
             }
 
         private:
-            int m_fd;
-            void* m_buf;
-            size_t m_len;
+            iovec m_iov;
+            T m_addr{};
+            msghdr m_hdr;
         };
 
         return recvfrom_awaitable(m_fd.get(), buf, len);
@@ -145,25 +158,26 @@ protected:
 public:
     auto recv(void* buf, size_t len)
     {
-        struct recv_awaitable
+        struct recv_awaitable : detail::io_operation<recv_awaitable, detail::io_direction::read>
         {
-            recv_awaitable(int fd, void* buf, size_t len) : m_fd(fd), m_buf(buf), m_len(len) {}
-            bool await_ready() const noexcept { return false; }
-            void await_suspend(std::coroutine_handle<> handle) const
+            recv_awaitable(int fd, void* buf, size_t len) : io_operation(fd), m_buf(buf), m_len(len) {}
+            ssize_t perform()
             {
-                event_loop::add_reader(m_fd, handle);
+                return detail::to_result(::recv(m_fd, m_buf, m_len, 0));
             }
-            ssize_t await_resume()
+            void prepare(io_uring_sqe& sqe)
             {
-                return ::recv(m_fd, m_buf, m_len, 0);
+                sqe.opcode = IORING_OP_RECV;
+                sqe.fd = m_fd;
+                sqe.addr = reinterpret_cast<std::uint64_t>(m_buf);
+                sqe.len = m_len;
             }
-            void await_cancel() const
+            ssize_t complete(ssize_t result) const
             {
-                event_loop::remove_fd(m_fd);
+                return detail::from_result(result);
             }
 
         private:
-            int m_fd;
             void* m_buf;
             size_t m_len;
         };
@@ -173,28 +187,27 @@ public:
 
     auto recv(iovec* iov, size_t iovlen) 
     {
-        struct recv_awaitable
+        struct recv_awaitable : detail::io_operation<recv_awaitable, detail::io_direction::read>
         {
-            recv_awaitable(int fd, iovec* iov, size_t len) : m_fd(fd), m_iov(iov), m_len(len) {}
-            bool await_ready() const noexcept { return false; }
-            void await_suspend(std::coroutine_handle<> handle) const
+            recv_awaitable(int fd, iovec* iov, size_t len) : io_operation(fd), m_hdr{nullptr, 0, iov, len, nullptr, 0, 0} {}
+            ssize_t perform()
             {
-                event_loop::add_reader(m_fd, handle);
+                return detail::to_result(recvmsg(m_fd, &m_hdr, 0));
             }
-            ssize_t await_resume()
+            void prepare(io_uring_sqe& sqe)
             {
-                msghdr hdr{nullptr, 0, m_iov, m_len, nullptr, 0, 0};
-                return recvmsg(m_fd, &hdr, 0);
+                sqe.opcode = IORING_OP_RECVMSG;
+                sqe.fd = m_fd;
+                sqe.addr = reinterpret_cast<std::uint64_t>(&m_hdr);
+                sqe.len = 1;
             }
-            void await_cancel() const
+            ssize_t complete(ssize_t result) const
             {
-                event_loop::remove_fd(m_fd);
+                return detail::from_result(result);
             }
 
         private:
-            int m_fd;
-            iovec* m_iov;
-            size_t m_len;
+            msghdr m_hdr;
         };
 
         return recv_awaitable(m_fd.get(), iov, iovlen);
@@ -202,25 +215,26 @@ public:
 
     auto send(const void* buf, size_t len)
     {
-        struct send_awaitable
+        struct send_awaitable : detail::io_operation<send_awaitable, detail::io_direction::write>
         {
-            send_awaitable(int fd, const void* buf, size_t len) : m_fd(fd), m_buf(buf), m_len(len) {}
-            bool await_ready() const noexcept { return false; }
-            void await_suspend(std::coroutine_handle<> handle) const
+            send_awaitable(int fd, const void* buf, size_t len) : io_operation(fd), m_buf(buf), m_len(len) {}
+            ssize_t perform()
             {
-                event_loop::add_writer(m_fd, handle);
+                return detail::to_result(::send(m_fd, m_buf, m_len, 0));
             }
-            ssize_t await_resume()
+            void prepare(io_uring_sqe& sqe)
             {
-                return ::send(m_fd, m_buf, m_len, 0);
+                sqe.opcode = IORING_OP_SEND;
+                sqe.fd = m_fd;
+                sqe.addr = reinterpret_cast<std::uint64_t>(m_buf);
+                sqe.len = m_len;
             }
-            void await_cancel() const
+            ssize_t complete(ssize_t result) const
             {
-                event_loop::remove_fd(m_fd);
+                return detail::from_result(result);
             }
 
         private:
-            int m_fd;
             const void* m_buf;
             size_t m_len;
         };
@@ -230,42 +244,49 @@ public:
 
     auto send(iovec* iov, size_t iovlen) 
     {
-        struct send_awaitable
+        struct send_awaitable : detail::io_operation<send_awaitable, detail::io_direction::write>
         {
-            send_awaitable(int fd, iovec* iov, size_t len) : m_fd(fd), m_iov(iov), m_len(len) {}
-            bool await_ready() const noexcept { return false; }
-            void await_suspend(std::coroutine_handle<> handle) const
+            send_awaitable(int fd, iovec* iov, size_t len) : io_operation(fd), m_hdr{nullptr, 0, iov, len, nullptr, 0, 0} {}
+            ssize_t perform()
             {
-                event_loop::add_writer(m_fd, handle);
+                return detail::to_result(sendmsg(m_fd, &m_hdr, 0));
             }
-            ssize_t await_resume()
+            void prepare(io_uring_sqe& sqe)
             {
-                msghdr hdr{nullptr, 0, m_iov, m_len, nullptr, 0, 0};
-                return sendmsg(m_fd, &hdr, 0);
+                sqe.opcode = IORING_OP_SENDMSG;
+                sqe.fd = m_fd;
+                sqe.addr = reinterpret_cast<std::uint64_t>(&m_hdr);
+                sqe.len = 1;
             }
-            void await_cancel() const
+            ssize_t complete(ssize_t result) const
             {
-                event_loop::remove_fd(m_fd);
+                return detail::from_result(result);
             }
 
         private:
-            int m_fd;
-            iovec* m_iov;
-            size_t m_len;
+            msghdr m_hdr;
         };
 
         return send_awaitable(m_fd.get(), iov, iovlen);
     }
 
-protected:
-    socket(int fd) : m_fd(fd) {}
-    socket(int family, int type)
+    void set_busy_poll(std::chrono::microseconds timeout)
     {
-        m_fd = detail::check_fd(::socket(family, type | SOCK_NONBLOCK, 0));
+        int usec = timeout.count();
+        detail::check_error(setsockopt(m_fd.get(), SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec)));
     }
+    void set_prefer_busy_poll(bool prefer)
+    {
+        int value = prefer;
+        detail::check_error(setsockopt(m_fd.get(), SOL_SOCKET, SO_PREFER_BUSY_POLL, &value, sizeof(value)));
+    }
+
+protected:
+    socket(int fd) : m_fd(fd) {}
+    socket(int family, int type) : m_fd(detail::check_fd(::socket(family, type | SOCK_NONBLOCK, 0))) {}
 
 private:
-    detail::unique_fd m_fd;
+    detail::watched_fd m_fd;
 };
 
 class ipv4_socket : public socket
@@ -357,26 +378,23 @@ protected:
     template <typename T>
     auto base_accept()
     {
-        struct accept_awaitable
+        struct accept_awaitable : detail::io_operation<accept_awaitable, detail::io_direction::read>
         {
-            accept_awaitable(int fd) : m_fd(fd) {}
-            bool await_ready() const noexcept { return false; }
-            void await_suspend(std::coroutine_handle<> handle) const
+            accept_awaitable(int fd) : accept_awaitable::io_operation(fd) {}
+            int perform()
             {
-                event_loop::add_reader(m_fd, handle);
+                return detail::to_result(::accept4(this->m_fd, nullptr, nullptr, SOCK_NONBLOCK));
             }
-            T await_resume()
+            void prepare(io_uring_sqe& sqe)
             {
-                int fd = detail::check_fd(::accept(m_fd, nullptr, nullptr));
-                return T(socket(fd));
+                sqe.opcode = IORING_OP_ACCEPT;
+                sqe.fd = this->m_fd;
+                sqe.accept_flags = SOCK_NONBLOCK;
             }
-            void await_cancel() const
+            T complete(ssize_t result)
             {
-                event_loop::remove_fd(m_fd);
+                return T(socket(detail::check_fd(detail::from_result(result))));
             }
-
-        private:
-            int m_fd;
         };
 
         return accept_awaitable(m_fd.get());
@@ -394,9 +412,7 @@ public:
         while (true) {
             auto sock = co_await accept();
 
-            [](socket s, auto&& f) -> detail::task_executor {
-                co_await f(std::move(s));
-            }(std::move(sock), std::forward<Func>(callback));
+            handle_connection(std::move(sock), callback);
         }
     }
 
@@ -409,9 +425,7 @@ public:
                 co_return;
             }
 
-            [](socket s, auto&& f) -> detail::task_executor {
-                co_await f(std::move(s));
-            }(std::move(*sock), std::forward<Func>(callback));
+            handle_connection(std::move(*sock), callback);
         }
     }
 
@@ -424,39 +438,77 @@ protected:
         detail::check_error(::bind(m_fd.get(), reinterpret_cast<sockaddr*>(&addr), sizeof(addr)));
     }
 
+    void set_reuse_port()
+    {
+        int enable = 1;
+        detail::check_error(setsockopt(m_fd.get(), SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)));
+    }
+
     void listen(int queued_connections)
     {
         detail::check_error(::listen(m_fd.get(), queued_connections));
     }
 
+    template <typename T>
+    auto local_address() const
+    {
+        T addr;
+        socklen_t len = sizeof(addr);
+        detail::check_error(getsockname(m_fd.get(), reinterpret_cast<sockaddr*>(&addr), &len));
+        return detail::from_sockaddr(addr);
+    }
+
 private:
-    detail::unique_fd m_fd;
+    // Handlers taking (std::allocator_arg_t, arena&, socket) get an arena that
+    // lives for the whole connection and is released in one step at its end.
+    template <typename Func>
+    static detail::task_executor handle_connection(socket s, Func& f)
+    {
+        if constexpr (std::is_invocable_v<Func&, std::allocator_arg_t, arena&, socket>) {
+            arena a;
+            co_await f(std::allocator_arg, a, std::move(s));
+        } else {
+            co_await f(std::move(s));
+        }
+    }
+
+    detail::watched_fd m_fd;
 };
 
 class tcpv4_listen_socket : public listen_socket
 {
 public:
-    tcpv4_listen_socket(ipv4_address addr, uint16_t port, int queued_connections = 1) : listen_socket(AF_INET)
+    tcpv4_listen_socket(ipv4_address addr, uint16_t port, int queued_connections = 1, bool reuse_port = false) : listen_socket(AF_INET)
     {
+        if (reuse_port) {
+            listen_socket::set_reuse_port();
+        }
         listen_socket::bind(detail::to_sockaddr(addr, port));
         listen_socket::listen(queued_connections);
     }
-    tcpv4_listen_socket(uint16_t port, int queued_connections = 1) : tcpv4_listen_socket(ipv4_address::any(), port, queued_connections) {}
+    tcpv4_listen_socket(uint16_t port, int queued_connections = 1, bool reuse_port = false) :
+        tcpv4_listen_socket(ipv4_address::any(), port, queued_connections, reuse_port) {}
     tcpv4_listen_socket(listen_socket&& socket) : listen_socket(std::move(socket)) {}
     auto accept() { return listen_socket::base_accept<ipv4_socket>(); }
+    uint16_t port() const { return listen_socket::local_address<sockaddr_in>().second; }
 };
 
 class tcpv6_listen_socket : public listen_socket
 {
 public:
-    tcpv6_listen_socket(ipv6_address addr, uint16_t port, int queued_connections = 1) : listen_socket(AF_INET6)
+    tcpv6_listen_socket(ipv6_address addr, uint16_t port, int queued_connections = 1, bool reuse_port = false) : listen_socket(AF_INET6)
     {
+        if (reuse_port) {
+            listen_socket::set_reuse_port();
+        }
         listen_socket::bind(detail::to_sockaddr(addr, port));
         listen_socket::listen(queued_connections);
     }
-    tcpv6_listen_socket(uint16_t port, int queued_connections = 1) : tcpv6_listen_socket(ipv6_address::any(), port, queued_connections) {}
+    tcpv6_listen_socket(uint16_t port, int queued_connections = 1, bool reuse_port = false) :
+        tcpv6_listen_socket(ipv6_address::any(), port, queued_connections, reuse_port) {}
     tcpv6_listen_socket(listen_socket&& socket) : listen_socket(std::move(socket)) {}
-    auto accept() { return listen_socket::base_accept<ipv4_socket>(); }
+    auto accept() { return listen_socket::base_accept<ipv6_socket>(); }
+    uint16_t port() const { return listen_socket::local_address<sockaddr_in6>().second; }
 };
 
 class unix_listen_socket : public listen_socket
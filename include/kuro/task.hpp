@@ -1,16 +1,282 @@
 #pragma once
 
+#include <algorithm>
+#include <chrono>
 #include <coroutine>
 #include <exception>
+#include <memory>
 #include <type_traits>
 #include <utility>
 
 #include "promise.hpp"
+#include "ready_queue.hpp"
+#include "time_slice.hpp"
+#include "timer_wheel.hpp"
 #include "unique_coroutine_handle.hpp"
+#include "util.hpp"
 
 namespace kuro
 {
 
+class task_cancelled : public std::exception
+{
+public:
+    const char* what() const noexcept override
+    {
+        return "task cancelled";
+    }
+};
+
+class deadline_exceeded : public std::exception
+{
+public:
+    const char* what() const noexcept override
+    {
+        return "deadline exceeded";
+    }
+};
+
+namespace detail
+{
+
+// Per-frame state shared with the awaitables of a task: what the frame is
+// suspended on, so that cancelling the task can cancel the innermost
+// awaitable, and the deadline inherited from the awaiting task. Only one
+// await of the frame is in flight at a time, so its state lives here rather
+// than in every tracked_awaitable.
+struct task_context
+{
+    // Allocated only for tasks that have a deadline.
+    struct deadline_timer : timer_node
+    {
+        deadline_timer(task_context& context, std::chrono::steady_clock::time_point deadline) :
+            timer_node(fire), context(context), deadline(deadline) {}
+        static void fire(timer_node& node)
+        {
+            auto& context = static_cast<deadline_timer&>(node).context;
+            context.expired = true;
+            if (context.cancel_awaitable()) {
+                context.queue();
+            }
+        }
+
+        task_context& context;
+        std::chrono::steady_clock::time_point deadline;
+    };
+
+    // Returns false if the awaitable resumes the frame itself once it is
+    // done, which is always the case for awaitables that can't be cancelled.
+    bool cancel_awaitable()
+    {
+        auto cancel = std::exchange(this->cancel, nullptr);
+        return cancel && cancel(*this);
+    }
+    // Resumes the frame from the ready queue, unless it is cancelled first.
+    void queue()
+    {
+        queued = true;
+        cancel = [](task_context& context) {
+            context.queued = false;
+            ready_queue::instance().erase(context.ticket);
+            return true;
+        };
+        ticket = ready_queue::instance().push(handle);
+    }
+
+    void* awaitable = nullptr;
+    bool (*cancel)(task_context&) = nullptr;
+    std::coroutine_handle<> handle;
+    // Of the frame's entry in the ready queue while it is queued.
+    ready_queue::ticket ticket = 0;
+    bool cancelled = false;
+    // Set while the frame unwinds from a task_cancelled thrown by an await.
+    bool threw_cancelled = false;
+    bool expired = false;
+    bool queued = false;
+    bool yielded = false;
+    std::unique_ptr<deadline_timer> deadline;
+};
+
+template <typename A>
+struct tracked_base
+{
+    using type = A&;
+};
+
+template <typename A>
+    requires generated_co_awaitable<A&>
+struct tracked_base<A>
+{
+    using type = get_base_awaitable_t<A&>;
+};
+
+// Awaitables that resume the awaiting coroutine on their own, without the
+// event loop, declare it with a static loop_independent() member. Only those
+// can be awaited in a work_stealing_scheduler::worker_task.
+template <typename A>
+concept loop_independent = std::remove_cvref_t<typename tracked_base<A>::type>::loop_independent();
+
+// Awaitables that may resume the awaiting coroutine on a worker thread of a
+// work_stealing_scheduler declare it with a static worker_only() member. A
+// task awaiting one would continue on the worker, away from its event loop.
+template <typename A>
+concept worker_only = std::remove_cvref_t<typename tracked_base<A>::type>::worker_only();
+
+// Awaitables are given the awaiting frame's handle with its promise type,
+// as they would be without the wrapper.
+template <typename A, typename Promise>
+class tracked_awaitable
+{
+    using base_t = tracked_base<A>::type;
+
+    static constexpr bool is_cancellable = requires (base_t a) { a.await_cancel(); };
+    static constexpr bool inherits_deadline = requires (base_t a) { a.inherit_deadline(std::chrono::steady_clock::time_point{}); };
+
+public:
+    tracked_awaitable(A& awaitable, task_context& context) : m_await(base(awaitable)), m_context(context)
+    {
+        m_context.threw_cancelled = false;
+    }
+    tracked_awaitable(const tracked_awaitable&) = delete;
+    tracked_awaitable& operator=(const tracked_awaitable&) = delete;
+
+    bool await_ready()
+    {
+        if (m_context.cancelled || m_context.deadline || time_slice::active()) [[unlikely]] {
+            return check_ready();
+        }
+        return m_await.await_ready();
+    }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle)
+    {
+        m_context.handle = handle;
+        m_context.awaitable = this;
+        if (m_context.yielded) {
+            // The awaitable is only consulted once it is the frame's turn
+            // again, since whatever it would see now may no longer hold then.
+            m_context.queued = true;
+            m_context.cancel = [](task_context& context) {
+                context.queued = false;
+                ready_queue::instance().erase(context.ticket);
+                return true;
+            };
+            m_context.ticket = ready_queue::instance().push(resume_yielded, this);
+            return std::noop_coroutine();
+        }
+        return suspend();
+    }
+    decltype(auto) await_resume()
+    {
+        bool suspended = std::exchange(m_context.awaitable, nullptr) != nullptr;
+        bool queued = std::exchange(m_context.queued, false);
+        m_context.cancel = nullptr;
+        if (m_context.deadline) {
+            m_context.deadline->cancel();
+        }
+        // An awaitable that completed although it was cancelled still
+        // returns its result, and the next await throws.
+        bool expired = std::exchange(m_context.expired, false);
+        if ((m_context.cancelled || expired) && (!suspended || queued || was_cancelled(m_await))) {
+            if (m_context.cancelled) {
+                m_context.threw_cancelled = true;
+                throw task_cancelled();
+            }
+            throw deadline_exceeded();
+        }
+        return m_await.await_resume();
+    }
+
+private:
+    bool check_ready()
+    {
+        if (m_context.cancelled) {
+            return true;
+        }
+        if (m_context.deadline) {
+            auto deadline = m_context.deadline->deadline;
+            if constexpr (requires { m_await.deadline(); }) {
+                m_context.expired = m_await.deadline() > deadline;
+            }
+            if constexpr (inherits_deadline) {
+                m_await.inherit_deadline(deadline);
+            }
+            if (m_context.expired || deadline <= std::chrono::steady_clock::now()) {
+                m_context.expired = true;
+                return true;
+            }
+        }
+        if (time_slice::active() && time_slice::instance().exhausted()) {
+            m_context.yielded = true;
+            return false;
+        }
+        return m_await.await_ready();
+    }
+    std::coroutine_handle<> suspend()
+    {
+        if constexpr (is_cancellable) {
+            m_context.cancel = [](task_context& context) {
+                return try_cancel(static_cast<tracked_awaitable*>(context.awaitable)->m_await);
+            };
+        } else {
+            m_context.cancel = nullptr;
+        }
+
+        auto handle = std::coroutine_handle<Promise>::from_address(m_context.handle.address());
+        using suspend_t = decltype(m_await.await_suspend(handle));
+        if constexpr (std::is_void_v<suspend_t>) {
+            m_await.await_suspend(handle);
+            arm_deadline();
+            return std::noop_coroutine();
+        } else if constexpr (std::is_same_v<suspend_t, bool>) {
+            if (m_await.await_suspend(handle)) {
+                arm_deadline();
+                return std::noop_coroutine();
+            }
+            return handle;
+        } else {
+            auto next = m_await.await_suspend(handle);
+            arm_deadline();
+            return next;
+        }
+    }
+    static void resume_yielded(void* p)
+    {
+        auto self = static_cast<tracked_awaitable*>(p);
+        self->m_context.yielded = false;
+        self->m_context.queued = false;
+        if (self->m_await.await_ready()) {
+            self->m_context.handle.resume();
+        } else {
+            self->suspend().resume();
+        }
+    }
+
+    static decltype(auto) base(A& awaitable)
+    {
+        if constexpr (generated_co_awaitable<A&>) {
+            return get_base_awaitable(awaitable);
+        } else {
+            return (awaitable);
+        }
+    }
+
+    // Nested tasks enforce the inherited deadline themselves, anything else
+    // that can be cancelled is cancelled by a timer once the deadline passes.
+    void arm_deadline()
+    {
+        if constexpr (is_cancellable && !inherits_deadline) {
+            if (m_context.deadline) {
+                timer_wheel::instance().arm(*m_context.deadline, m_context.deadline->deadline);
+            }
+        }
+    }
+
+    base_t m_await;
+    task_context& m_context;
+};
+
+}
+
 template <typename T>
 class task
 {
@@ -30,9 +296,12 @@ public:
                 bool await_ready() noexcept { return false; }
                 std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept
                 {
-                    auto continuation = handle.promise().m_continuation;
-                    if (continuation) {
-                        return continuation;
+                    auto& promise = handle.promise();
+                    if (promise.m_hook) {
+                        return promise.m_hook->notify(*promise.m_hook);
+                    }
+                    if (promise.m_continuation) {
+                        return promise.m_continuation;
                     }
 
                     return std::noop_coroutine();
@@ -45,11 +314,71 @@ public:
         {
             m_continuation = continuation;
         }
+        void set_hook(detail::completion_hook& hook)
+        {
+            m_hook = &hook;
+        }
+
+        template <typename A>
+        auto await_transform(A&& awaitable)
+        {
+            static_assert(!detail::worker_only<std::remove_reference_t<A>>, "awaitable resumes on a work_stealing_scheduler worker and can't be awaited in a task");
+            return detail::tracked_awaitable<std::remove_reference_t<A>, promise_type>(awaitable, m_context);
+        }
+
+        // Always returns false: the frame throws task_cancelled from its
+        // current await, right away from the ready queue if that could be
+        // cancelled at once and otherwise once it completes, or from its next
+        // one, and resumes the awaiting coroutine when it has unwound. Its
+        // catch blocks run like they do for any other exception.
+        bool cancel()
+        {
+            m_context.cancelled = true;
+            if (m_context.deadline) {
+                m_context.deadline->cancel();
+            }
+            if (m_context.cancel_awaitable()) {
+                m_context.queue();
+            }
+            return false;
+        }
+        // Whether the frame ended with the task_cancelled thrown by one of
+        // its awaits. A frame that catches it and awaits again clears this.
+        bool unwound_cancelled() const noexcept
+        {
+            return m_context.threw_cancelled && this->has_exception();
+        }
+        // Takes a frame that is about to be destroyed out of the ready queue.
+        void abandon()
+        {
+            if (m_context.queued) {
+                m_context.cancel_awaitable();
+            }
+        }
+        void set_deadline(std::chrono::steady_clock::time_point deadline)
+        {
+            if (!m_context.deadline) {
+                m_context.deadline = std::make_unique<detail::task_context::deadline_timer>(m_context, deadline);
+            } else {
+                m_context.deadline->deadline = std::min(m_context.deadline->deadline, deadline);
+            }
+        }
 
     private:
         std::coroutine_handle<> m_continuation;
+        detail::completion_hook* m_hook = nullptr;
+        detail::task_context m_context;
     };
 
+    task(task&&) noexcept = default;
+    task& operator=(task&&) noexcept = default;
+    ~task()
+    {
+        if (m_handle && !m_handle.done()) {
+            m_handle.promise().abandon();
+        }
+    }
+
     auto operator co_await()
     {
         struct awaitable
@@ -68,6 +397,30 @@ public:
                 m_handle.promise().set_continuation(parent_handle);
                 return m_handle;
             }
+            // Returns the frame to start, which notifies hook instead of
+            // resuming an awaiter as it reaches its final suspend.
+            std::coroutine_handle<> await_notify(detail::completion_hook& hook) noexcept
+            {
+                m_handle.promise().set_hook(hook);
+                return m_handle;
+            }
+            // The frame resumes its awaiter as it reaches its final suspend.
+            bool await_done() const noexcept
+            {
+                return m_handle.done();
+            }
+            bool await_cancel()
+            {
+                return m_handle.promise().cancel();
+            }
+            bool await_cancelled() const
+            {
+                return m_handle.promise().unwound_cancelled();
+            }
+            void inherit_deadline(std::chrono::steady_clock::time_point deadline)
+            {
+                m_handle.promise().set_deadline(deadline);
+            }
         
         private:
             std::coroutine_handle<promise_type> m_handle;
@@ -80,7 +433,20 @@ public:
     {
         return m_handle.done();
     }
-    
+
+    // Operations awaited by the task, or by tasks it awaits in turn, fail
+    // with deadline_exceeded instead of running past the deadline.
+    task with_deadline(std::chrono::steady_clock::time_point deadline) &&
+    {
+        m_handle.promise().set_deadline(deadline);
+        return std::move(*this);
+    }
+    template <typename Rep, typename Period>
+    task with_deadline(std::chrono::duration<Rep, Period> timeout) &&
+    {
+        return std::move(*this).with_deadline(std::chrono::steady_clock::now() + timeout);
+    }
+
 
 private:
     task(std::coroutine_handle<promise_type> handle) : m_handle(handle) {}
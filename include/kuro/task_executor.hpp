@@ -10,7 +10,7 @@ namespace kuro::detail
 class task_executor
 {
 public:
-    class promise_type
+    class promise_type : public pooled_frame
     {
     public:
         task_executor get_return_object() noexcept
@@ -0,0 +1,253 @@
+#pragma once
+
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <limits>
+#include <list>
+#include <utility>
+
+#include "continuation.hpp"
+#include "ready_queue.hpp"
+#include "task.hpp"
+#include "util.hpp"
+
+namespace kuro
+{
+
+// Runs child tasks concurrently, with at most max_concurrency of them in
+// flight, and joins them before the group goes away.
+class task_group
+{
+    class child : public detail::resume_callback<child>
+    {
+        friend detail::resume_callback<child>;
+        friend task_group;
+
+    public:
+        child(task_group& group, task<void> t) :
+            m_group(group),
+            m_task(std::move(t)),
+            m_await(m_task.operator co_await()) {}
+
+    private:
+        std::coroutine_handle<> on_resume() noexcept
+        {
+            return m_group.finish(*this, true);
+        }
+
+        task_group& m_group;
+        task<void> m_task;
+        decltype(std::declval<task<void>&>().operator co_await()) m_await;
+        std::list<child>::iterator m_self;
+        bool m_cancelling = false;
+    };
+
+    struct spawn_waiter : detail::waiter_node
+    {
+        bool has_slot = false;
+    };
+
+public:
+    explicit task_group(std::size_t max_concurrency = std::numeric_limits<std::size_t>::max()) :
+        m_max_concurrency(max_concurrency > 0 ? max_concurrency : 1) {}
+    task_group(const task_group&) = delete;
+    task_group& operator=(const task_group&) = delete;
+    ~task_group()
+    {
+        if (m_cancelled) {
+            detail::ready_queue::instance().erase(m_cancel_ticket);
+        }
+        cancel_children();
+    }
+
+    auto spawn(task<void> t)
+    {
+        struct awaitable
+        {
+            awaitable(task_group* group, task<void> t) : m_group(group), m_task(std::move(t)) {}
+            bool await_ready() noexcept
+            {
+                if (m_group->m_cancelled) {
+                    return true;
+                }
+                if (m_group->m_running < m_group->m_max_concurrency && m_group->m_spawners.empty()) {
+                    ++m_group->m_running;
+                    m_waiter.has_slot = true;
+                    return true;
+                }
+                return false;
+            }
+            void await_suspend(std::coroutine_handle<> handle) noexcept
+            {
+                m_waiter.handle = handle;
+                m_group->m_spawners.push(m_waiter);
+            }
+            void await_resume()
+            {
+                m_group->start(std::move(m_task), m_waiter.has_slot);
+            }
+            void await_cancel() noexcept
+            {
+                if (!m_group->m_spawners.erase(m_waiter)) {
+                    m_waiter.unschedule();
+                    if (m_waiter.has_slot) {
+                        m_group->release_slot();
+                    }
+                }
+            }
+
+        private:
+            task_group* m_group;
+            task<void> m_task;
+            spawn_waiter m_waiter;
+        };
+
+        return awaitable{this, std::move(t)};
+    }
+
+    auto join()
+    {
+        struct awaitable
+        {
+            awaitable(task_group* group) : m_group(group) {}
+            bool await_ready() const noexcept
+            {
+                return m_group->m_running == 0;
+            }
+            void await_suspend(std::coroutine_handle<> handle) noexcept
+            {
+                m_waiter.handle = handle;
+                m_group->m_joiners.push(m_waiter);
+            }
+            void await_resume() const
+            {
+                if (m_group->m_exception) {
+                    std::rethrow_exception(m_group->m_exception);
+                }
+            }
+            // Cancels the group, and keeps waiting until every child has
+            // unwound, so that the owner can't unwind past a live child.
+            bool await_cancel() noexcept
+            {
+                m_cancelled = true;
+                m_group->cancel();
+                return false;
+            }
+            bool await_cancelled() const noexcept
+            {
+                return m_cancelled;
+            }
+
+        private:
+            task_group* m_group;
+            detail::waiter_node m_waiter;
+            bool m_cancelled = false;
+        };
+
+        return awaitable{this};
+    }
+
+    // Cancels all children, and makes further spawns throw task_cancelled.
+    void cancel()
+    {
+        if (m_cancelled) {
+            return;
+        }
+
+        m_cancelled = true;
+        m_spawners.resume_all();
+        // From the ready queue, where none of the children can be running.
+        m_cancel_ticket = detail::ready_queue::instance().push(deferred_cancel, this);
+    }
+    std::size_t size() const noexcept
+    {
+        return m_children.size();
+    }
+
+private:
+    void start(task<void> t, bool has_slot)
+    {
+        if (m_cancelled) {
+            if (has_slot) {
+                release_slot();
+            }
+            if (m_exception) {
+                std::rethrow_exception(m_exception);
+            }
+            throw task_cancelled();
+        }
+
+        auto& c = m_children.emplace_back(*this, std::move(t));
+        c.m_self = std::prev(m_children.end());
+        if (!detail::suspend_on(c.m_await, c.handle())) {
+            finish(c);
+        }
+    }
+    std::coroutine_handle<> finish(child& c, bool transfer = false)
+    {
+        // A child that unwound because it was cancelled didn't fail.
+        if (!c.m_cancelling || !detail::was_cancelled(c.m_await)) {
+            try {
+                c.m_await.await_resume();
+            } catch (...) {
+                if (!m_exception) {
+                    m_exception = std::current_exception();
+                    cancel();
+                }
+            }
+        }
+
+        m_children.erase(c.m_self);
+        return release_slot(transfer);
+    }
+    // With transfer, when a child's completion resumes the group, a lone
+    // waiter it wakes is returned for symmetric transfer, not scheduled.
+    std::coroutine_handle<> release_slot(bool transfer = false)
+    {
+        if (!m_cancelled) {
+            if (auto node = m_spawners.pop()) {
+                static_cast<spawn_waiter*>(node)->has_slot = true;
+                if (transfer) {
+                    return node->handle;
+                }
+                node->schedule();
+                return std::noop_coroutine();
+            }
+        }
+
+        if (--m_running == 0) {
+            if (transfer) {
+                return m_joiners.transfer_all();
+            }
+            m_joiners.resume_all();
+        }
+        return std::noop_coroutine();
+    }
+    static void deferred_cancel(void* group)
+    {
+        static_cast<task_group*>(group)->cancel_children();
+    }
+    // A cancelled child unwinds from the ready queue, and stays in the group
+    // until it has.
+    void cancel_children()
+    {
+        for (auto& c : m_children) {
+            if (!c.m_cancelling) {
+                c.m_cancelling = true;
+                c.m_await.await_cancel();
+            }
+        }
+    }
+
+    std::size_t m_max_concurrency;
+    std::size_t m_running = 0;
+    std::list<child> m_children;
+    intrusive_continuation m_spawners;
+    intrusive_continuation m_joiners;
+    std::exception_ptr m_exception;
+    bool m_cancelled = false;
+    detail::ready_queue::ticket m_cancel_ticket = 0;
+};
+
+}
\ No newline at end of file
@@ -0,0 +1,221 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace kuro::detail
+{
+
+// Jobs are queued in a bounded lock-free MPMC ring (Vyukov's), and idle
+// workers park on a futex through atomic::wait. A job that finds the ring
+// full goes to an overflow list behind a mutex, as do the ones submitted
+// after it until the workers have drained it.
+class thread_pool
+{
+public:
+    // Owned by the submitter, typically embedded in an awaitable, and kept
+    // alive until it has run or been withdrawn.
+    struct job
+    {
+        void (*run)(job&) = nullptr;
+        // Where the job was queued, so that it is withdrawn in O(1) without
+        // the queue ever referencing it afterwards.
+        std::size_t position = 0;
+        job* prev = nullptr;
+        job* next = nullptr;
+        bool linked = false;
+    };
+
+private:
+    static constexpr std::size_t overflow_position = SIZE_MAX;
+
+    struct cell
+    {
+        std::atomic<std::size_t> sequence;
+        // Cleared by a withdrawal, which leaves the cell for a worker to
+        // skip.
+        std::atomic<job*> queued = nullptr;
+    };
+
+public:
+    explicit thread_pool(std::size_t n_threads, std::size_t capacity = 1024) :
+        m_mask(std::bit_ceil(std::max<std::size_t>(capacity, 2)) - 1),
+        m_cells(new cell[m_mask + 1])
+    {
+        for (std::size_t i = 0; i <= m_mask; ++i) {
+            m_cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        m_threads.reserve(n_threads);
+        for (std::size_t i = 0; i < n_threads; ++i) {
+            m_threads.emplace_back([this] { work(); });
+        }
+    }
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+    // Jobs still queued are run before the workers exit, so that none is
+    // left waiting for a completion that never comes.
+    ~thread_pool()
+    {
+        m_stop.store(true, std::memory_order_relaxed);
+        m_signal.fetch_add(1, std::memory_order_release);
+        m_signal.notify_all();
+    }
+
+    void submit(job& j)
+    {
+        if (m_overflowed.load(std::memory_order_relaxed) != 0 || !enqueue(j)) {
+            std::lock_guard lock(m_mutex);
+            j.position = overflow_position;
+            j.prev = m_overflow_tail;
+            j.next = nullptr;
+            j.linked = true;
+            (m_overflow_tail ? m_overflow_tail->next : m_overflow_head) = &j;
+            m_overflow_tail = &j;
+            m_overflowed.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        // Pairs with the fence of a parking worker, so that either it sees
+        // the job or this sees it parking.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_sleepers.load(std::memory_order_relaxed) != 0) {
+            m_signal.fetch_add(1, std::memory_order_release);
+            m_signal.notify_one();
+        }
+    }
+    // Takes a job out of the queue. Returns false if a worker already took
+    // it. Must be called from the submitting thread.
+    bool withdraw(job& j)
+    {
+        if (j.position != overflow_position) {
+            auto expected = &j;
+            return m_cells[j.position & m_mask].queued.compare_exchange_strong(expected, nullptr, std::memory_order_relaxed);
+        }
+
+        std::lock_guard lock(m_mutex);
+        if (!j.linked) {
+            return false;
+        }
+        unlink(j);
+        return true;
+    }
+
+private:
+    bool enqueue(job& j)
+    {
+        auto pos = m_enqueue.load(std::memory_order_relaxed);
+        cell* c;
+        while (true) {
+            c = &m_cells[pos & m_mask];
+            auto diff = std::intptr_t(c->sequence.load(std::memory_order_acquire)) - std::intptr_t(pos);
+            if (diff == 0) {
+                if (m_enqueue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = m_enqueue.load(std::memory_order_relaxed);
+            }
+        }
+
+        j.position = pos;
+        c->queued.store(&j, std::memory_order_relaxed);
+        c->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+    // Returns false once both queues are empty. A withdrawn job is taken as
+    // nullptr.
+    bool dequeue(job*& j)
+    {
+        auto pos = m_dequeue.load(std::memory_order_relaxed);
+        cell* c;
+        while (true) {
+            c = &m_cells[pos & m_mask];
+            auto diff = std::intptr_t(c->sequence.load(std::memory_order_acquire)) - std::intptr_t(pos + 1);
+            if (diff == 0) {
+                if (m_dequeue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return dequeue_overflow(j);
+            } else {
+                pos = m_dequeue.load(std::memory_order_relaxed);
+            }
+        }
+
+        j = c->queued.exchange(nullptr, std::memory_order_acquire);
+        c->sequence.store(pos + m_mask + 1, std::memory_order_release);
+        return true;
+    }
+    bool dequeue_overflow(job*& j)
+    {
+        if (m_overflowed.load(std::memory_order_relaxed) == 0) {
+            return false;
+        }
+
+        std::lock_guard lock(m_mutex);
+        j = m_overflow_head;
+        if (j) {
+            unlink(*j);
+        }
+        return j != nullptr;
+    }
+    void unlink(job& j)
+    {
+        (j.prev ? j.prev->next : m_overflow_head) = j.next;
+        (j.next ? j.next->prev : m_overflow_tail) = j.prev;
+        j.linked = false;
+        m_overflowed.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    void work()
+    {
+        job* j;
+        while (true) {
+            if (dequeue(j)) {
+                if (j) {
+                    j->run(*j);
+                }
+                continue;
+            }
+
+            auto signal = m_signal.load(std::memory_order_acquire);
+            m_sleepers.fetch_add(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (!dequeue(j)) {
+                if (m_stop.load(std::memory_order_relaxed)) {
+                    return;
+                }
+                m_signal.wait(signal, std::memory_order_acquire);
+            } else if (j) {
+                m_sleepers.fetch_sub(1, std::memory_order_relaxed);
+                j->run(*j);
+                continue;
+            }
+            m_sleepers.fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+
+    std::size_t m_mask;
+    std::unique_ptr<cell[]> m_cells;
+    alignas(64) std::atomic<std::size_t> m_enqueue = 0;
+    alignas(64) std::atomic<std::size_t> m_dequeue = 0;
+    alignas(64) std::atomic<std::uint32_t> m_signal = 0;
+    std::atomic<std::uint32_t> m_sleepers = 0;
+    std::atomic<bool> m_stop = false;
+    std::mutex m_mutex;
+    job* m_overflow_head = nullptr;
+    job* m_overflow_tail = nullptr;
+    // Only changed under the mutex, and read without it to skip the list.
+    std::atomic<std::size_t> m_overflowed = 0;
+    std::vector<std::jthread> m_threads;
+};
+
+}
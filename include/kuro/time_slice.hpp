@@ -0,0 +1,82 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+
+namespace kuro::detail
+{
+
+// Bounds how long coroutines may keep running before the loop polls for IO
+// again. Awaits in tasks are counted, and once the slice is used up they
+// yield to the ready queue until the next loop iteration starts a new one.
+class time_slice
+{
+    // Reading the clock costs more than most awaits that don't suspend, so
+    // it is only read every so many of them.
+    static constexpr std::size_t clock_interval = 16;
+
+public:
+    time_slice(const time_slice&) = delete;
+    time_slice& operator=(const time_slice&) = delete;
+
+    static time_slice& instance()
+    {
+        static thread_local time_slice inst;
+        return inst;
+    }
+
+    // Whether awaits are counted at all, so that without a slice an await
+    // only reads this thread-local flag.
+    static bool active() noexcept
+    {
+        return m_active;
+    }
+
+    void configure(std::chrono::nanoseconds length, std::size_t max_awaits) noexcept
+    {
+        m_length = length;
+        m_max_awaits = max_awaits;
+        m_active = length.count() != 0 || max_awaits != 0;
+    }
+    void start() noexcept
+    {
+        m_awaits = 0;
+        m_end = {};
+        m_exhausted = false;
+    }
+    bool exhausted() noexcept
+    {
+        if (m_exhausted) {
+            return true;
+        }
+
+        ++m_awaits;
+        if (m_max_awaits != 0 && m_awaits >= m_max_awaits) {
+            m_exhausted = true;
+        } else if (m_length.count() != 0 && m_awaits % clock_interval == 1) {
+            // The slice starts at its first await rather than with the loop
+            // iteration, so that time spent blocked in the IO poll isn't
+            // charged to it.
+            auto now = std::chrono::steady_clock::now();
+            if (m_end == std::chrono::steady_clock::time_point{}) {
+                m_end = now + m_length;
+            } else {
+                m_exhausted = now >= m_end;
+            }
+        }
+        return m_exhausted;
+    }
+
+private:
+    time_slice() = default;
+
+    std::chrono::nanoseconds m_length{0};
+    std::size_t m_max_awaits = 0;
+    std::size_t m_awaits = 0;
+    std::chrono::steady_clock::time_point m_end;
+    bool m_exhausted = false;
+
+    static inline thread_local constinit bool m_active = false;
+};
+
+}
\ No newline at end of file
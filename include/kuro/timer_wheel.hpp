@@ -0,0 +1,218 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+
+namespace kuro::detail
+{
+
+class timer_node
+{
+    friend class timer_wheel;
+
+public:
+    using callback_t = void (*)(timer_node&);
+
+    timer_node() : m_callback(nullptr)
+    {
+        m_prev = m_next = this;
+    }
+    explicit timer_node(callback_t callback) : m_callback(callback) {}
+    timer_node(const timer_node& other) : m_callback(other.m_callback) {}
+    timer_node& operator=(const timer_node&) = delete;
+    ~timer_node()
+    {
+        cancel();
+    }
+
+    bool armed() const noexcept
+    {
+        return m_next != nullptr;
+    }
+    void cancel() noexcept
+    {
+        if (armed()) {
+            m_prev->m_next = m_next;
+            m_next->m_prev = m_prev;
+            m_prev = m_next = nullptr;
+        }
+    }
+
+private:
+    void push_back(timer_node& node) noexcept
+    {
+        node.m_prev = m_prev;
+        node.m_next = this;
+        m_prev->m_next = &node;
+        m_prev = &node;
+    }
+    bool empty() const noexcept
+    {
+        return m_next == this;
+    }
+
+    timer_node* m_prev = nullptr;
+    timer_node* m_next = nullptr;
+    std::uint64_t m_expiry = 0;
+    callback_t m_callback;
+};
+
+class timer_wheel
+{
+    using clock = std::chrono::steady_clock;
+    using tick = std::chrono::milliseconds;
+
+    static constexpr int slot_bits = 6;
+    static constexpr int n_slots = 1 << slot_bits;
+    static constexpr int n_levels = 6;
+    static constexpr std::uint64_t max_delta = (std::uint64_t(1) << (slot_bits * n_levels)) - 1;
+
+    struct level
+    {
+        std::array<timer_node, n_slots> slots;
+        std::uint64_t occupied = 0;
+    };
+
+public:
+    timer_wheel(const timer_wheel&) = delete;
+    timer_wheel& operator=(const timer_wheel&) = delete;
+    static timer_wheel& instance()
+    {
+        static thread_local timer_wheel inst;
+        return inst;
+    }
+
+    ~timer_wheel()
+    {
+        for (auto& l : m_levels) {
+            for (auto& slot : l.slots) {
+                detach_all(slot);
+            }
+        }
+        detach_all(m_expired);
+    }
+
+    void arm(timer_node& node, clock::time_point deadline)
+    {
+        node.cancel();
+        auto expiry = std::chrono::ceil<tick>(deadline.time_since_epoch()).count();
+        node.m_expiry = std::max<std::uint64_t>(expiry, m_current + 1);
+        insert(node);
+    }
+
+    int timeout(clock::time_point now) const
+    {
+        if (!m_expired.empty()) {
+            return 0;
+        }
+
+        auto next = std::numeric_limits<std::uint64_t>::max();
+        for (int l = 0; l < n_levels; ++l) {
+            auto occupied = m_levels[l].occupied;
+            if (occupied == 0) {
+                continue;
+            }
+
+            auto shift = slot_bits * l;
+            auto position = (m_current >> shift) + 1;
+            auto offset = std::countr_zero(std::rotr(occupied, position % n_slots));
+            next = std::min(next, (position + offset) << shift);
+        }
+
+        if (next == std::numeric_limits<std::uint64_t>::max()) {
+            return -1;
+        }
+
+        // Timers too far out for an int wait are waited for in steps.
+        auto remaining = std::chrono::ceil<tick>(tick(next) - now.time_since_epoch()).count();
+        return std::clamp<std::int64_t>(remaining, 0, std::numeric_limits<int>::max());
+    }
+
+    void expire(clock::time_point now)
+    {
+        advance(to_tick(now));
+        while (!m_expired.empty()) {
+            auto& node = *m_expired.m_next;
+            node.cancel();
+            node.m_callback(node);
+        }
+    }
+
+private:
+    timer_wheel() : m_current(to_tick(clock::now())) {}
+
+    static std::uint64_t to_tick(clock::time_point t)
+    {
+        return std::chrono::floor<tick>(t.time_since_epoch()).count();
+    }
+
+    static void detach_all(timer_node& list)
+    {
+        while (!list.empty()) {
+            list.m_next->cancel();
+        }
+    }
+
+    void insert(timer_node& node)
+    {
+        if (node.m_expiry <= m_current) {
+            m_expired.push_back(node);
+            return;
+        }
+
+        auto expiry = std::min(node.m_expiry, m_current + max_delta);
+        auto delta = expiry - m_current;
+        int l = 0;
+        while (l < n_levels - 1 && delta >= (std::uint64_t(1) << (slot_bits * (l + 1)))) {
+            ++l;
+        }
+
+        auto slot = (expiry >> (slot_bits * l)) % n_slots;
+        m_levels[l].slots[slot].push_back(node);
+        m_levels[l].occupied |= std::uint64_t(1) << slot;
+    }
+
+    void advance(std::uint64_t now)
+    {
+        while (m_current < now) {
+            auto window = m_current / n_slots;
+            auto first = (m_current + 1) % n_slots;
+            auto pending = first == 0 ? 0 : m_levels[0].occupied >> first << first;
+            auto next = pending ? window * n_slots + std::countr_zero(pending) : (window + 1) * n_slots;
+            if (next > now) {
+                m_current = now;
+                return;
+            }
+
+            m_current = next;
+            for (int l = n_levels - 1; l > 0; --l) {
+                auto shift = slot_bits * l;
+                if (m_current % (std::uint64_t(1) << shift) == 0) {
+                    cascade(l, (m_current >> shift) % n_slots);
+                }
+            }
+            cascade(0, m_current % n_slots);
+        }
+    }
+
+    void cascade(int l, std::uint64_t slot)
+    {
+        auto& list = m_levels[l].slots[slot];
+        m_levels[l].occupied &= ~(std::uint64_t(1) << slot);
+        while (!list.empty()) {
+            auto& node = *list.m_next;
+            node.cancel();
+            insert(node);
+        }
+    }
+
+    std::array<level, n_levels> m_levels;
+    timer_node m_expired;
+    std::uint64_t m_current;
+};
+
+}
\ No newline at end of file
@@ -12,6 +12,14 @@ class unique_coroutine_handle
 public:
     unique_coroutine_handle() noexcept = default;
     unique_coroutine_handle(std::coroutine_handle<Promise> h) : m_ptr(h.address()) {}
+    explicit operator bool() const noexcept
+    {
+        return bool(m_ptr);
+    }
+    void release() noexcept
+    {
+        m_ptr.release();
+    }
     bool done() const
     {
         return handle().done();
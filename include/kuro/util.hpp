@@ -2,7 +2,11 @@
 
 #include <concepts>
 #include <coroutine>
+#include <exception>
 #include <type_traits>
+#include <utility>
+
+#include "frame_allocator.hpp"
 
 namespace kuro
 {
@@ -92,6 +96,159 @@ using non_void_awaited_t = std::conditional_t<std::is_void_v<awaited_t<T>>, void
 template <typename T>
 concept await_suspend_returnable = std::same_as<T, bool> || std::same_as<T, void> || std::same_as<T, std::coroutine_handle<>>;
 
+// A coroutine that an awaitable can resume in place of the awaiting one.
+// Resuming it detaches it from its owner, calls Derived::on_resume(), then
+// destroys its frame and continues with the coroutine on_resume() returned,
+// so on_resume() may destroy the owner. Until then the owner destroys it.
+// on_resume() must be noexcept, since nothing owns the frame while it runs.
+// A Shared one instead calls on_resume() each time it is resumed, so that
+// several awaitables can resume the same frame, and stays with its owner.
+template <typename Derived, bool Shared = false>
+class resume_callback
+{
+    struct frame
+    {
+        struct promise_type : pooled_frame
+        {
+            frame get_return_object() noexcept
+            {
+                return frame{std::coroutine_handle<promise_type>::from_promise(*this)};
+            }
+            std::suspend_always initial_suspend() const noexcept { return {}; }
+            std::suspend_never final_suspend() const noexcept { return {}; }
+            void return_void() noexcept {}
+            void unhandled_exception() noexcept
+            {
+                std::terminate();
+            }
+        };
+
+        std::coroutine_handle<promise_type> handle;
+    };
+
+    struct transfer
+    {
+        bool await_ready() const noexcept { return false; }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> self) noexcept
+        {
+            auto next = m_next;
+            if constexpr (!Shared) {
+                self.destroy();
+            }
+            return next;
+        }
+        void await_resume() const noexcept {}
+
+        std::coroutine_handle<> m_next;
+    };
+
+public:
+    resume_callback() = default;
+    // Copies start out without a frame, like a waiter_node.
+    resume_callback(const resume_callback&) noexcept {}
+    resume_callback& operator=(const resume_callback&) noexcept
+    {
+        return *this;
+    }
+    ~resume_callback()
+    {
+        if (m_frame) {
+            m_frame.destroy();
+        }
+    }
+
+    // The same frame until it is resumed, and a new one after that unless
+    // it is Shared.
+    std::coroutine_handle<> handle()
+    {
+        if (!m_frame) {
+            m_frame = run(this).handle;
+        }
+        return m_frame;
+    }
+
+private:
+    static frame run(resume_callback* self)
+    {
+        static_assert(noexcept(std::declval<Derived&>().on_resume()), "on_resume() must be noexcept");
+        if constexpr (Shared) {
+            while (true) {
+                co_await transfer{static_cast<Derived*>(self)->on_resume()};
+            }
+        } else {
+            self->m_frame = nullptr;
+            auto next = static_cast<Derived*>(self)->on_resume();
+            co_await transfer{next};
+        }
+    }
+
+    std::coroutine_handle<> m_frame;
+};
+
+// Lets an awaitable complete into a combinator instead of resuming a
+// coroutine: one with await_notify(hook) calls hook.notify() once it is
+// done, and continues with the coroutine that returns, so that completions
+// are counted without a frame to resume.
+struct completion_hook
+{
+    std::coroutine_handle<> (*notify)(completion_hook&) noexcept = nullptr;
+};
+
+template <typename A>
+concept hook_notifiable = requires(A& a, completion_hook& hook) {
+    { a.await_notify(hook) } -> std::same_as<std::coroutine_handle<>>;
+};
+
+// Suspends on an awaitable on behalf of handle. Returns false if it
+// completed without suspending, in which case handle won't be resumed.
+template <typename A>
+bool suspend_on(A& awaitable, std::coroutine_handle<> handle)
+{
+    using S = decltype(awaitable.await_suspend(handle));
+    if constexpr (std::is_void_v<S>) {
+        awaitable.await_suspend(handle);
+        return true;
+    } else if constexpr (std::is_same_v<S, bool>) {
+        return awaitable.await_suspend(handle);
+    } else {
+        awaitable.await_suspend(handle).resume();
+        return true;
+    }
+}
+
+// Cancelling an awaitable either takes effect at once, and then whoever
+// cancelled it resumes the awaiting coroutine, or, when await_cancel()
+// returns false, is left to the awaitable, which resumes the coroutine
+// itself once it is done and reports through await_cancelled() whether it
+// was cancelled after all.
+template <typename A>
+bool try_cancel(A& awaitable)
+{
+    if constexpr (std::is_void_v<decltype(awaitable.await_cancel())>) {
+        awaitable.await_cancel();
+        return true;
+    } else {
+        return awaitable.await_cancel();
+    }
+}
+
+// An awaitable whose await_done() tells whether it has resumed its awaiter,
+// so that awaitables sharing one continuation can be told apart.
+template <typename A>
+concept completion_observable = requires(const A& a) {
+    { a.await_done() } -> std::same_as<bool>;
+};
+
+template <typename A>
+bool was_cancelled(A& awaitable)
+{
+    if constexpr (requires { awaitable.await_cancelled(); }) {
+        return awaitable.await_cancelled();
+    } else {
+        return true;
+    }
+}
+
 }
 
 template <typename T>
@@ -104,6 +261,9 @@ concept awaitable = requires(detail::base_awaitable_t<T> a) {
 template <typename T>
 concept cancellable = requires(detail::base_awaitable_t<T> a) {
     { a.await_cancel() } -> std::same_as<void>;
+} || requires(detail::base_awaitable_t<T> a) {
+    { a.await_cancel() } -> std::same_as<bool>;
+    { a.await_cancelled() } -> std::same_as<bool>;
 };
 
 template <typename T>
@@ -1,28 +1,99 @@
 #pragma once
 
+#include <chrono>
 #include <coroutine>
+#include <optional>
+#include <type_traits>
 
 #include "cancellation.hpp"
 #include "util.hpp"
 #include "sleep.hpp"
-#include "task_executor.hpp"
+#include "timer_wheel.hpp"
 
 namespace kuro
 {
 
-template <typename T, typename Cancel>
+namespace detail
+{
+
+class cancellation_source
+{
+public:
+    cancellation_source(cancellation& cancel) : m_cancel(&cancel) {}
+    bool ready() const noexcept
+    {
+        return m_cancel->is_set();
+    }
+    void arm(waiter_node& node)
+    {
+        m_cancel->add_waiter(node);
+    }
+    void disarm(waiter_node& node) noexcept
+    {
+        m_cancel->remove_waiter(node);
+    }
+
+private:
+    cancellation* m_cancel;
+};
+
+class timeout_source
+{
+public:
+    timeout_source(duration d) : m_deadline(std::chrono::steady_clock::now() + static_cast<std::chrono::nanoseconds>(d)) {}
+    bool ready() const noexcept
+    {
+        return m_deadline <= std::chrono::steady_clock::now();
+    }
+    void arm(waiter_node& node)
+    {
+        m_timer.waiter = &node;
+        event_loop::add_timer(m_timer, m_deadline);
+    }
+    void disarm(waiter_node&) noexcept
+    {
+        m_timer.cancel();
+    }
+
+private:
+    struct expiry_timer : timer_node
+    {
+        expiry_timer() : timer_node(fire) {}
+        static void fire(timer_node& node)
+        {
+            auto waiter = static_cast<expiry_timer&>(node).waiter;
+            waiter->notify(*waiter);
+        }
+
+        waiter_node* waiter = nullptr;
+    };
+
+    std::chrono::steady_clock::time_point m_deadline;
+    expiry_timer m_timer;
+};
+
+}
+
+// Woken through a waiter node it embeds, so it needs no coroutine frame.
+template <typename T, typename Source>
 class cancel_awaitable
 {
+    enum class state
+    {
+        running,
+        cancelled,
+        cancelling
+    };
+
 public:
-    cancel_awaitable(T awaitable, Cancel cancel) : 
+    cancel_awaitable(T awaitable, Source source) : 
         m_await(std::forward<T>(awaitable)),
-        m_cancel_await(std::move(cancel)),
-        m_cancelled(false) {}
+        m_source(std::move(source)) {}
 
     bool await_ready()
     {
-        if (m_cancel_await.await_ready()) {
-            m_cancelled = true;
+        if (m_source.ready()) {
+            m_state = state::cancelled;
             return true;
         }
         
@@ -30,53 +101,101 @@ public:
     }
     auto await_suspend(std::coroutine_handle<> handle)
     {
-        m_exec_handle = [](std::coroutine_handle<> h, cancel_awaitable* ptr) -> detail::task_executor {
-            co_await ptr->m_cancel_await;
-            ptr->m_cancelled = true;
-            ptr->m_await.get().await_cancel();
-            h.resume();
-        }(handle, this).m_handle;
-        return m_await.get().await_suspend(handle);
+        m_node.handle = handle;
+        m_node.notify = on_cancel;
+        m_node.self = this;
+
+        using suspend_t = decltype(m_await.get().await_suspend(handle));
+        if constexpr (std::is_same_v<suspend_t, bool>) {
+            if (!m_await.get().await_suspend(handle)) {
+                return false;
+            }
+            m_source.arm(m_node);
+            return true;
+        } else if constexpr (std::is_void_v<suspend_t>) {
+            m_await.get().await_suspend(handle);
+            m_source.arm(m_node);
+        } else {
+            auto next = m_await.get().await_suspend(handle);
+            m_source.arm(m_node);
+            return next;
+        }
     }
     std::optional<detail::non_void_awaited_t<T>> await_resume()
     {
-        if (m_cancelled) {
+        if (m_state == state::running) {
+            m_source.disarm(m_node);
+        } else if (await_cancelled()) {
             return {};
+        }
+
+        if constexpr (std::is_void_v<detail::awaited_t<T>>) {
+            m_await.get().await_resume();
+            return void_t{};
         } else {
-            m_cancel_await.await_cancel();
-            m_exec_handle.destroy();
-            if constexpr (std::is_void_v<detail::awaited_t<T>>) {
-                m_await.get().await_resume();
-                return void_t{};
-            } else {
-                return m_await.get().await_resume();
-            }
+            return m_await.get().await_resume();
         }
     }
-    void await_cancel()
+    void inherit_deadline(std::chrono::steady_clock::time_point deadline)
+        requires requires (detail::awaitable_container<T> a) { a.get().inherit_deadline(deadline); }
     {
-        m_await.get().await_cancel();
-        m_cancel_await.await_cancel();
-        m_exec_handle.destroy();
+        m_await.get().inherit_deadline(deadline);
+    }
+    bool await_cancel()
+    {
+        if (m_state == state::cancelled) {
+            m_node.unschedule();
+            return true;
+        }
+        if (m_state == state::cancelling) {
+            return false;
+        }
+        m_state = state::cancelling;
+        if (detail::try_cancel(m_await.get())) {
+            m_state = state::cancelled;
+        }
+        m_source.disarm(m_node);
+        return m_state == state::cancelled;
+    }
+    // An awaitable that couldn't be cancelled at once may still complete.
+    bool await_cancelled()
+    {
+        return m_state == state::cancelled ||
+            (m_state == state::cancelling && detail::was_cancelled(m_await.get()));
     }
 
 private:
+    struct cancel_node : detail::waiter_node
+    {
+        cancel_awaitable* self = nullptr;
+    };
+
+    static void on_cancel(detail::waiter_node& node)
+    {
+        auto self = static_cast<cancel_node&>(node).self;
+        self->m_state = state::cancelling;
+        if (detail::try_cancel(self->m_await.get())) {
+            self->m_state = state::cancelled;
+            node.schedule();
+        }
+    }
+
     detail::awaitable_container<T> m_await;
-    Cancel m_cancel_await;
-    bool m_cancelled;
-    std::coroutine_handle<> m_exec_handle;
+    Source m_source;
+    state m_state = state::running;
+    cancel_node m_node;
 };
 
 template <cancellable_awaitable T>
 auto with_cancellation(T&& aw, cancellation& cancel)
 {
-    return cancel_awaitable<T, decltype(cancel.wait())>(std::forward<T>(aw), cancel.wait());
+    return cancel_awaitable<T, detail::cancellation_source>(std::forward<T>(aw), cancel);
 }
 
 template <cancellable_awaitable T>
 auto with_timeout(T&& aw, duration d)
 {
-    return cancel_awaitable<T, decltype(sleep_for(d))>(std::forward<T>(aw), sleep_for(d));
+    return cancel_awaitable<T, detail::timeout_source>(std::forward<T>(aw), d);
 }
 
 }
\ No newline at end of file
@@ -0,0 +1,419 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "chase_lev_deque.hpp"
+#include "promise.hpp"
+#include "shared_task.hpp"
+#include "task.hpp"
+#include "task_executor.hpp"
+#include "unique_coroutine_handle.hpp"
+
+namespace kuro
+{
+
+class work_stealing_scheduler
+{
+    struct worker
+    {
+        detail::chase_lev_deque<std::coroutine_handle<>> deque;
+        std::jthread thread;
+    };
+
+    static constexpr std::uintptr_t running = 0;
+    static constexpr std::uintptr_t finished = 1;
+    static constexpr std::uintptr_t detached = 2;
+
+    // Forwards to an awaitable, which the await_transform of a worker_task
+    // has checked.
+    template <typename A>
+    class worker_awaitable
+    {
+    public:
+        worker_awaitable(A& awaitable) : m_await(base(awaitable)) {}
+        worker_awaitable(const worker_awaitable&) = delete;
+        worker_awaitable& operator=(const worker_awaitable&) = delete;
+
+        bool await_ready()
+        {
+            return m_await.await_ready();
+        }
+        auto await_suspend(std::coroutine_handle<> handle)
+        {
+            return m_await.await_suspend(handle);
+        }
+        decltype(auto) await_resume()
+        {
+            return m_await.await_resume();
+        }
+
+    private:
+        static decltype(auto) base(A& awaitable)
+        {
+            if constexpr (detail::generated_co_awaitable<A&>) {
+                return detail::get_base_awaitable(awaitable);
+            } else {
+                return (awaitable);
+            }
+        }
+
+        detail::tracked_base<A>::type m_await;
+    };
+
+    // Only a worker_task can await it, so that a task never moves onto the
+    // workers.
+    class schedule_operation
+    {
+        template <typename>
+        friend class worker_awaitable;
+
+    public:
+        static constexpr bool loop_independent() noexcept { return true; }
+
+        schedule_operation(work_stealing_scheduler& scheduler) : m_scheduler(scheduler) {}
+
+    private:
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+            m_scheduler.enqueue(handle);
+        }
+        void await_resume() const noexcept {}
+
+        work_stealing_scheduler& m_scheduler;
+    };
+
+public:
+    // A task that runs on the workers. No event loop runs there, so it can
+    // only await other worker_tasks, forked_tasks and schedule(), which is
+    // checked at compile time.
+    template <typename T>
+    class worker_task
+    {
+    public:
+        class promise_type final : public detail::base_promise_t<T>
+        {
+        public:
+            worker_task<T> get_return_object() noexcept
+            {
+                return worker_task(std::coroutine_handle<promise_type>::from_promise(*this));
+            }
+            std::suspend_always initial_suspend() const noexcept { return {}; }
+            auto final_suspend() const noexcept
+            {
+                struct awaitable
+                {
+                    bool await_ready() noexcept { return false; }
+                    std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept
+                    {
+                        auto continuation = handle.promise().m_continuation;
+                        if (continuation) {
+                            return continuation;
+                        }
+
+                        return std::noop_coroutine();
+                    }
+                    void await_resume() noexcept {}
+                };
+                return awaitable{};
+            }
+
+            template <typename A>
+            auto await_transform(A&& awaitable)
+            {
+                static_assert(detail::loop_independent<std::remove_reference_t<A>>, "awaitable needs an event loop and can't be awaited in a worker_task");
+                return worker_awaitable<std::remove_reference_t<A>>(awaitable);
+            }
+
+        private:
+            friend worker_task;
+
+            std::coroutine_handle<> m_continuation;
+        };
+
+        worker_task(worker_task&&) noexcept = default;
+        worker_task& operator=(worker_task&&) noexcept = default;
+
+        auto operator co_await() noexcept
+        {
+            struct awaitable
+            {
+                static constexpr bool loop_independent() noexcept { return true; }
+                static constexpr bool worker_only() noexcept { return true; }
+
+                bool await_ready() const noexcept
+                {
+                    return m_handle.done();
+                }
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<> parent_handle) noexcept
+                {
+                    m_handle.promise().m_continuation = parent_handle;
+                    return m_handle;
+                }
+                T await_resume()
+                {
+                    return m_handle.promise().result();
+                }
+
+                std::coroutine_handle<promise_type> m_handle;
+            };
+
+            return awaitable{m_handle};
+        }
+
+    private:
+        worker_task(std::coroutine_handle<promise_type> handle) : m_handle(handle) {}
+
+        detail::unique_coroutine_handle<promise_type> m_handle;
+    };
+
+    template <typename T>
+    class forked_task
+    {
+    public:
+        class promise_type final : public detail::base_promise_t<T>
+        {
+        public:
+            forked_task<T> get_return_object() noexcept
+            {
+                return forked_task(std::coroutine_handle<promise_type>::from_promise(*this));
+            }
+            std::suspend_always initial_suspend() const noexcept { return {}; }
+            auto final_suspend() const noexcept
+            {
+                struct awaitable
+                {
+                    bool await_ready() noexcept { return false; }
+                    std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept
+                    {
+                        auto state = handle.promise().m_state.exchange(finished, std::memory_order_acq_rel);
+                        if (state == detached) {
+                            handle.destroy();
+                        } else if (state != running) {
+                            return std::coroutine_handle<>::from_address(reinterpret_cast<void*>(state));
+                        }
+                        return std::noop_coroutine();
+                    }
+                    void await_resume() noexcept {}
+                };
+                return awaitable{};
+            }
+
+        private:
+            friend forked_task;
+
+            std::atomic<std::uintptr_t> m_state = running;
+        };
+
+        forked_task(forked_task&& other) noexcept : m_handle(std::exchange(other.m_handle, nullptr)) {}
+        forked_task& operator=(forked_task&&) = delete;
+        ~forked_task()
+        {
+            if (m_handle && m_handle.promise().m_state.exchange(detached, std::memory_order_acq_rel) == finished) {
+                m_handle.destroy();
+            }
+        }
+
+        static constexpr bool loop_independent() noexcept { return true; }
+        static constexpr bool worker_only() noexcept { return true; }
+
+        bool await_ready() const noexcept
+        {
+            return m_handle.promise().m_state.load(std::memory_order_acquire) == finished;
+        }
+        bool await_suspend(std::coroutine_handle<> parent_handle) noexcept
+        {
+            auto expected = running;
+            auto waiter = reinterpret_cast<std::uintptr_t>(parent_handle.address());
+            return m_handle.promise().m_state.compare_exchange_strong(expected, waiter, std::memory_order_acq_rel);
+        }
+        decltype(auto) await_resume()
+        {
+            return m_handle.promise().result();
+        }
+
+    private:
+        friend work_stealing_scheduler;
+
+        forked_task(std::coroutine_handle<promise_type> handle) : m_handle(handle) {}
+
+        auto join() noexcept
+        {
+            struct awaitable
+            {
+                static constexpr bool loop_independent() noexcept { return true; }
+
+                bool await_ready() const noexcept { return m_task.await_ready(); }
+                bool await_suspend(std::coroutine_handle<> handle) noexcept { return m_task.await_suspend(handle); }
+                void await_resume() const noexcept {}
+
+                forked_task& m_task;
+            };
+
+            return awaitable{*this};
+        }
+
+        std::coroutine_handle<promise_type> m_handle;
+    };
+
+    explicit work_stealing_scheduler(std::size_t n_workers = std::max(1u, std::thread::hardware_concurrency()))
+    {
+        m_workers.reserve(n_workers);
+        for (std::size_t i = 0; i < n_workers; ++i) {
+            m_workers.push_back(std::make_unique<worker>());
+        }
+        for (std::size_t i = 0; i < n_workers; ++i) {
+            m_workers[i]->thread = std::jthread([this, i] { work(i); });
+        }
+    }
+    work_stealing_scheduler(const work_stealing_scheduler&) = delete;
+    work_stealing_scheduler& operator=(const work_stealing_scheduler&) = delete;
+    ~work_stealing_scheduler()
+    {
+        m_stop.store(true, std::memory_order_seq_cst);
+        m_epoch.fetch_add(1, std::memory_order_seq_cst);
+        m_epoch.notify_all();
+        for (auto& w : m_workers) {
+            w->thread.join();
+        }
+    }
+
+    std::size_t size() const noexcept
+    {
+        return m_workers.size();
+    }
+
+    auto schedule()
+    {
+        return schedule_operation{*this};
+    }
+
+    template <typename T>
+    forked_task<T> create_task(worker_task<T> concurrent_task)
+    {
+        auto forked = [](worker_task<T> t) -> forked_task<T> {
+            co_return co_await t;
+        }(std::move(concurrent_task));
+
+        enqueue(forked.m_handle);
+        return forked;
+    }
+    template <typename T>
+    void create_task(task<T>)
+    {
+        static_assert(!sizeof(T*), "task may await the event loop and cannot run on a work_stealing_scheduler, use worker_task");
+    }
+    template <typename T>
+    void create_task(shared_task<T>)
+    {
+        static_assert(!sizeof(T*), "shared_task is not thread-safe and cannot run on a work_stealing_scheduler");
+    }
+
+    template <typename T>
+    T run(worker_task<T> root_task)
+    {
+        std::mutex mutex;
+        std::condition_variable cv;
+        bool done = false;
+
+        auto forked = create_task(std::move(root_task));
+        [](forked_task<T>& f, std::mutex& m, std::condition_variable& c, bool& d) -> detail::task_executor {
+            co_await f.join();
+            std::lock_guard lock(m);
+            d = true;
+            c.notify_one();
+        }(forked, mutex, cv, done);
+
+        std::unique_lock lock(mutex);
+        cv.wait(lock, [&] { return done; });
+        return forked.await_resume();
+    }
+
+private:
+    void enqueue(std::coroutine_handle<> handle)
+    {
+        if (m_current == this) {
+            m_workers[m_index]->deque.push(handle);
+        } else {
+            std::lock_guard lock(m_injection_mutex);
+            m_injected.push_back(handle);
+        }
+
+        m_epoch.fetch_add(1, std::memory_order_seq_cst);
+        if (m_sleeping.load(std::memory_order_seq_cst) > 0) {
+            m_epoch.notify_one();
+        }
+    }
+
+    std::coroutine_handle<> next(std::size_t index)
+    {
+        if (auto h = m_workers[index]->deque.pop()) {
+            return *h;
+        }
+
+        {
+            std::lock_guard lock(m_injection_mutex);
+            if (!m_injected.empty()) {
+                auto h = m_injected.front();
+                m_injected.pop_front();
+                return h;
+            }
+        }
+
+        for (std::size_t i = 1; i < m_workers.size(); ++i) {
+            if (auto h = m_workers[(index + i) % m_workers.size()]->deque.steal()) {
+                return *h;
+            }
+        }
+        return nullptr;
+    }
+
+    void work(std::size_t index)
+    {
+        m_current = this;
+        m_index = index;
+        while (true) {
+            if (auto h = next(index)) {
+                h.resume();
+                continue;
+            }
+
+            m_sleeping.fetch_add(1, std::memory_order_seq_cst);
+            auto epoch = m_epoch.load(std::memory_order_seq_cst);
+            if (m_stop.load(std::memory_order_seq_cst)) {
+                m_sleeping.fetch_sub(1, std::memory_order_seq_cst);
+                return;
+            }
+            if (auto h = next(index)) {
+                m_sleeping.fetch_sub(1, std::memory_order_seq_cst);
+                h.resume();
+                continue;
+            }
+            m_epoch.wait(epoch, std::memory_order_seq_cst);
+            m_sleeping.fetch_sub(1, std::memory_order_seq_cst);
+        }
+    }
+
+    static inline thread_local work_stealing_scheduler* m_current = nullptr;
+    static inline thread_local std::size_t m_index = 0;
+
+    std::vector<std::unique_ptr<worker>> m_workers;
+    std::mutex m_injection_mutex;
+    std::deque<std::coroutine_handle<>> m_injected;
+    std::atomic<std::uint32_t> m_epoch{0};
+    std::atomic<std::uint32_t> m_sleeping{0};
+    std::atomic<bool> m_stop{false};
+};
+
+}
\ No newline at end of file
@@ -0,0 +1,96 @@
+#include <optional>
+#include <tuple>
+#include <vector>
+
+#include "catch.hpp"
+#include "kuro/kuro.hpp"
+
+// Counts the pushes made while the channel was full, which must suspend.
+static kuro::task<int> produce(kuro::channel<int>& ch, int n)
+{
+    int blocked = 0;
+    for (int i = 0; i < n; ++i) {
+        bool full = ch.full();
+        co_await ch.push(i);
+        blocked += full;
+    }
+    ch.close();
+    co_return blocked;
+}
+
+static kuro::task<std::pair<int, std::size_t>> consume(kuro::channel<int>& ch)
+{
+    int sum = 0;
+    std::size_t max_size = 0;
+    while (true) {
+        max_size = std::max(max_size, ch.size());
+        auto value = co_await ch.pop();
+        if (!value) {
+            break;
+        }
+        sum += *value;
+        co_await kuro::sleep_for(std::chrono::nanoseconds(1));
+    }
+    co_return {sum, max_size};
+}
+
+static kuro::task<std::tuple<int, std::size_t, int>> backpressure()
+{
+    kuro::channel<int> ch(3);
+    auto producer = kuro::event_loop::create_task(produce(ch, 100));
+    auto [sum, max_size] = co_await consume(ch);
+    auto blocked = co_await producer;
+    co_return {sum, max_size, blocked};
+}
+
+template <typename Channel>
+static kuro::task<bool> push_then_close(Channel& ch)
+{
+    co_return co_await ch.push(3);
+}
+
+template <typename Continuation>
+static kuro::task<std::vector<std::optional<int>>> close_wakes_waiters()
+{
+    kuro::channel<int, Continuation> ch(2);
+    ch.try_push(1);
+    ch.try_push(2);
+    auto blocked = kuro::event_loop::create_task(push_then_close(ch));
+    co_await kuro::yield();
+    ch.close();
+
+    bool pushed = co_await blocked;
+    std::vector<std::optional<int>> popped;
+    for (int i = 0; i < 3; ++i) {
+        popped.push_back(co_await ch.pop());
+    }
+    popped.push_back(pushed ? 1 : 0);
+    co_return popped;
+}
+
+TEST_CASE("channel")
+{
+    kuro::channel<int> ch(3);
+    REQUIRE(ch.capacity() == 3);
+    REQUIRE(ch.try_push(1));
+    REQUIRE(ch.try_push(2));
+    REQUIRE(ch.try_push(3));
+    REQUIRE(ch.full());
+    REQUIRE(!ch.try_push(4));
+    REQUIRE(ch.try_pop() == 1);
+    REQUIRE(ch.try_push(4));
+    REQUIRE(ch.try_pop() == 2);
+    REQUIRE(ch.try_pop() == 3);
+    REQUIRE(ch.try_pop() == 4);
+    REQUIRE(!ch.try_pop());
+
+    auto [sum, max_size, blocked] = kuro::event_loop::run(backpressure());
+    REQUIRE(sum == 4950);
+    REQUIRE(max_size <= 3);
+    REQUIRE(blocked > 0);
+
+    auto popped = kuro::event_loop::run(close_wakes_waiters<kuro::intrusive_continuation>());
+    REQUIRE(popped == std::vector<std::optional<int>>{1, 2, std::nullopt, 0});
+    popped = kuro::event_loop::run(close_wakes_waiters<kuro::multi_continuation>());
+    REQUIRE(popped == std::vector<std::optional<int>>{1, 2, std::nullopt, 0});
+}
\ No newline at end of file
@@ -0,0 +1,135 @@
+#include <queue>
+#include <vector>
+
+#include "catch.hpp"
+#include "kuro/kuro.hpp"
+
+using fifo_queue = kuro::queuelike<std::queue<int>, kuro::intrusive_continuation>;
+
+static kuro::task<void> consume(fifo_queue& q, std::vector<int>& order, int id)
+{
+    co_await q.pop();
+    order.push_back(id);
+}
+
+static kuro::task<void> consume_with_cancellation(fifo_queue& q, std::vector<int>& order, int id, kuro::cancellation& cancel)
+{
+    auto value = co_await kuro::with_cancellation(q.pop(), cancel);
+    if (value) {
+        order.push_back(id);
+    }
+}
+
+static kuro::task<std::vector<int>> fifo_wakeups()
+{
+    fifo_queue q;
+    kuro::cancellation cancel;
+    std::vector<int> order;
+
+    auto a = kuro::event_loop::create_task(consume(q, order, 1));
+    auto b = kuro::event_loop::create_task(consume_with_cancellation(q, order, 2, cancel));
+    auto c = kuro::event_loop::create_task(consume(q, order, 3));
+    auto d = kuro::event_loop::create_task(consume(q, order, 4));
+    co_await kuro::sleep_for(std::chrono::milliseconds(1));
+
+    cancel.trigger();
+    co_await b;
+    for (int i = 0; i < 3; ++i) {
+        q.push(i);
+    }
+    co_await a;
+    co_await c;
+    co_await d;
+    co_return order;
+}
+
+static kuro::task<int> many_cancelled_waiters()
+{
+    kuro::event<kuro::intrusive_continuation> never;
+    int timed_out = 0;
+    std::vector<kuro::shared_task<void>> waiters;
+    for (int i = 0; i < 1000; ++i) {
+        waiters.push_back(kuro::event_loop::create_task([](auto& ev, int& n) -> kuro::shared_task<void> {
+            auto woken = co_await kuro::with_timeout(ev.wait(), std::chrono::milliseconds(1));
+            if (!woken) {
+                ++n;
+            }
+        }(never, timed_out)));
+    }
+    for (auto& w : waiters) {
+        co_await w;
+    }
+    co_return timed_out;
+}
+
+struct resume_counter : kuro::detail::resume_callback<resume_counter>
+{
+    std::coroutine_handle<> on_resume() noexcept
+    {
+        ++resumed;
+        return std::noop_coroutine();
+    }
+
+    int resumed = 0;
+};
+
+static kuro::task<int> resume_through_loop(resume_counter& counter)
+{
+    kuro::cancellation cancel;
+    kuro::detail::waiter_node node;
+    node.handle = counter.handle();
+    cancel.add_waiter(node);
+    cancel.trigger();
+    co_await kuro::yield();
+    kuro::detail::ready_queue::instance().push(counter.handle());
+    co_await kuro::yield();
+    co_return counter.resumed;
+}
+
+TEST_CASE("resume_callback")
+{
+    resume_counter counter;
+    auto handle = counter.handle();
+    REQUIRE(counter.handle() == handle);
+    REQUIRE(!handle.done());
+
+    handle.resume();
+    REQUIRE(counter.resumed == 1);
+    REQUIRE(kuro::event_loop::run(resume_through_loop(counter)) == 3);
+
+    // A frame that is never resumed is destroyed with its owner.
+    resume_counter unused;
+    unused.handle();
+}
+
+TEST_CASE("intrusive_continuation")
+{
+    REQUIRE(kuro::event_loop::run(fifo_wakeups()) == std::vector<int>{1, 3, 4});
+    REQUIRE(kuro::event_loop::run(many_cancelled_waiters()) == 1000);
+}
+
+TEST_CASE("ready_queue")
+{
+    auto& ready = kuro::detail::ready_queue::instance();
+    std::vector<int> ran;
+    kuro::detail::ready_queue::ticket later = 0;
+    kuro::detail::ready_queue::ticket erased = 0;
+
+    auto first = ready.push([&] {
+        ran.push_back(1);
+        // Entries further on in the running batch can still be erased.
+        REQUIRE(ready.erase(erased));
+        later = ready.push([&] { ran.push_back(4); });
+    });
+    auto cancelled = ready.push([&] { ran.push_back(2); });
+    erased = ready.push([&] { ran.push_back(3); });
+    REQUIRE(ready.erase(cancelled));
+    REQUIRE(!ready.erase(cancelled));
+
+    ready.run_batch();
+    REQUIRE(ran == std::vector<int>{1});
+    REQUIRE(!ready.erase(first));
+    ready.run_batch();
+    REQUIRE(ran == std::vector<int>{1, 4});
+    REQUIRE(!ready.erase(later));
+}
\ No newline at end of file
@@ -0,0 +1,410 @@
+#include <atomic>
+#include <future>
+#include <limits>
+#include <memory_resource>
+#include <thread>
+#include <vector>
+
+#include "catch.hpp"
+#include "kuro/kuro.hpp"
+
+static std::vector<int> order;
+
+static kuro::task<void> schedule_callbacks()
+{
+    kuro::event_loop::call_later(std::chrono::milliseconds(20), [] { order.push_back(3); });
+    kuro::event_loop::call_later(std::chrono::milliseconds(10), [] { order.push_back(2); });
+    kuro::event_loop::call_soon([] { order.push_back(1); });
+    co_await kuro::sleep_for(std::chrono::milliseconds(30));
+}
+
+static kuro::queue<int> queue;
+static kuro::cancellation cancel;
+
+static kuro::task<std::optional<int>> pop_with_cancellation()
+{
+    co_return co_await kuro::with_cancellation(queue.pop(), cancel);
+}
+
+static kuro::task<std::pair<std::optional<int>, int>> cancel_then_push()
+{
+    auto waiter = kuro::event_loop::create_task(pop_with_cancellation());
+    cancel.trigger();
+    queue.push(10);
+    auto cancelled = co_await waiter;
+    auto value = co_await queue.pop();
+    co_return {cancelled, value};
+}
+
+static kuro::task<std::pair<std::vector<int>, std::chrono::steady_clock::duration>> sleep_many()
+{
+    std::vector<int> woken;
+    auto sleeper = [&](int ms) -> kuro::task<void> {
+        co_await kuro::sleep_until(std::chrono::steady_clock::now() + std::chrono::milliseconds(ms));
+        woken.push_back(ms);
+    };
+    auto start = std::chrono::steady_clock::now();
+    co_await kuro::gather(sleeper(70), sleeper(3), sleeper(0), sleeper(20));
+    co_await kuro::with_timeout(kuro::sleep_for(std::chrono::seconds(10)), std::chrono::milliseconds(1));
+    co_return {woken, std::chrono::steady_clock::now() - start};
+}
+
+static kuro::task<void> busy_sleep()
+{
+    kuro::event_loop::set_busy_poll(std::chrono::microseconds(500));
+    co_await kuro::sleep_for(std::chrono::milliseconds(2));
+    kuro::event_loop::set_busy_poll(std::chrono::microseconds(0));
+}
+
+static kuro::task<int> add_on_loop(int a, int b)
+{
+    co_await kuro::sleep_for(std::chrono::milliseconds(1));
+    co_return a + b;
+}
+
+static kuro::task<std::pair<int, int>> threadsafe_submission()
+{
+    auto& loop = kuro::event_loop::current();
+    kuro::cancellation finished;
+    int posted = 0;
+    int results = 0;
+
+    std::jthread producer([&] {
+        for (int i = 0; i < 100; ++i) {
+            loop.post([&] { ++posted; });
+        }
+        auto from_callable = loop.run_threadsafe([] { return 40; });
+        auto from_task = loop.run_threadsafe([] { return add_on_loop(1, 1); });
+        results = from_callable.get() + from_task.get();
+        finished.trigger();
+    });
+
+    co_await finished.wait();
+    co_return {posted, results};
+}
+
+static kuro::task<bool> offload_blocking_work()
+{
+    auto loop_thread = std::this_thread::get_id();
+    auto worker_thread = co_await kuro::run_in_executor([] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        return std::this_thread::get_id();
+    });
+
+    int sum = 0;
+    for (int i = 0; i < 100; ++i) {
+        sum += co_await kuro::run_in_executor([i] { return i; });
+    }
+
+    bool rethrown = false;
+    try {
+        co_await kuro::run_in_executor([] { throw std::runtime_error("failed"); });
+    } catch (const std::runtime_error&) {
+        rethrown = true;
+    }
+
+    // Cancelled while it runs, so it runs to completion and its result is
+    // returned.
+    auto& loop = kuro::event_loop::current();
+    kuro::cancellation cancel;
+    auto finished = co_await kuro::with_cancellation(kuro::run_in_executor([&] {
+        loop.post([&] { cancel.trigger(); });
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        return 1;
+    }), cancel);
+
+    co_return worker_thread != loop_thread && std::this_thread::get_id() == loop_thread
+        && sum == 4950 && rethrown && finished == 1;
+}
+
+// On a new thread, whose pool has a single worker that another call keeps
+// busy, so the timed out call is still queued.
+static bool timeout_on_saturated_pool()
+{
+    return std::async(std::launch::async, [] {
+        kuro::event_loop::set_executor_threads(1);
+        return kuro::event_loop::run([]() -> kuro::task<bool> {
+            std::atomic<bool> release = false;
+            auto blocker = kuro::event_loop::create_task([](std::atomic<bool>& r) -> kuro::task<void> {
+                co_await kuro::run_in_executor([&r] { r.wait(false); });
+            }(release));
+            kuro::event_loop::call_later(std::chrono::milliseconds(200), [&] {
+                release = true;
+                release.notify_one();
+            });
+
+            auto start = std::chrono::steady_clock::now();
+            auto result = co_await kuro::with_timeout(kuro::run_in_executor([] { return 1; }), std::chrono::milliseconds(10));
+            auto elapsed = std::chrono::steady_clock::now() - start;
+            co_await blocker;
+            co_return !result && elapsed < std::chrono::milliseconds(100);
+        }());
+    }).get();
+}
+
+struct counted_job : kuro::detail::thread_pool::job
+{
+    std::atomic<int>* count;
+    std::atomic<bool>* release = nullptr;
+};
+
+static int drain_pool_on_shutdown()
+{
+    std::atomic<int> count = 0;
+    std::vector<counted_job> jobs(16);
+    {
+        kuro::detail::thread_pool pool(1);
+        for (auto& j : jobs) {
+            j.run = [](kuro::detail::thread_pool::job& j) {
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+                ++*static_cast<counted_job&>(j).count;
+            };
+            j.count = &count;
+            pool.submit(j);
+        }
+    }
+    return count;
+}
+
+// A ring of two cells, so that most of the jobs overflow. The worker is
+// kept busy by the first job while every other one is withdrawn.
+static int withdraw_from_pool()
+{
+    std::atomic<int> count = 0;
+    std::atomic<bool> release = false;
+    std::vector<counted_job> jobs(8);
+    for (auto& j : jobs) {
+        j.run = [](kuro::detail::thread_pool::job& j) { ++*static_cast<counted_job&>(j).count; };
+        j.count = &count;
+        j.release = &release;
+    }
+    jobs[0].run = [](kuro::detail::thread_pool::job& j) {
+        auto& self = static_cast<counted_job&>(j);
+        ++*self.count;
+        while (!*self.release) {
+            std::this_thread::yield();
+        }
+    };
+
+    {
+        kuro::detail::thread_pool pool(1, 2);
+        pool.submit(jobs[0]);
+        while (count == 0) {
+            std::this_thread::yield();
+        }
+        for (std::size_t i = 1; i < jobs.size(); ++i) {
+            pool.submit(jobs[i]);
+        }
+        for (std::size_t i = 1; i < jobs.size(); i += 2) {
+            if (!pool.withdraw(jobs[i])) {
+                return -1;
+            }
+        }
+        release = true;
+    }
+    return count;
+}
+
+// On a new thread, whose timer wheel holds only this timer.
+static int far_timer_timeout()
+{
+    return std::async(std::launch::async, [] {
+        kuro::detail::timer_node node([](kuro::detail::timer_node&) {});
+        auto now = std::chrono::steady_clock::now();
+        kuro::detail::timer_wheel::instance().arm(node, now + std::chrono::days(365));
+        return kuro::detail::timer_wheel::instance().timeout(now);
+    }).get();
+}
+
+class counting_resource : public std::pmr::memory_resource
+{
+public:
+    int allocations = 0;
+
+private:
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+        ++allocations;
+        return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+    void do_deallocate(void* ptr, std::size_t bytes, std::size_t alignment) override
+    {
+        std::pmr::new_delete_resource()->deallocate(ptr, bytes, alignment);
+    }
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+    {
+        return this == &other;
+    }
+};
+
+static kuro::task<int> pmr_queue(std::pmr::memory_resource* resource)
+{
+    kuro::pmr::queue<int> q(resource);
+    kuro::event<kuro::multi_continuation> ready(resource);
+    auto consumer = kuro::event_loop::create_task([](auto& q, auto& ready) -> kuro::task<int> {
+        co_await ready.wait();
+        co_return co_await q.pop() + co_await q.pop();
+    }(q, ready));
+    kuro::event_loop::call_soon([&] {
+        q.push(1);
+        q.push(2);
+        ready.set();
+    });
+    co_return co_await consumer;
+}
+
+static kuro::task<void> count_with_yields(std::vector<int>& out, int id)
+{
+    for (int i = 0; i < 3; ++i) {
+        out.push_back(id * 10 + i);
+        co_await kuro::yield();
+    }
+}
+
+static kuro::task<std::vector<int>> interleave()
+{
+    std::vector<int> out;
+    auto a = kuro::event_loop::create_task(count_with_yields(out, 1));
+    auto b = kuro::event_loop::create_task(count_with_yields(out, 2));
+    co_await a;
+    co_await b;
+    co_return out;
+}
+
+static kuro::task<void> set_after_yield(bool& flag)
+{
+    co_await kuro::yield();
+    flag = true;
+}
+
+static kuro::task<void> leave_callback(bool& ran)
+{
+    kuro::event_loop::call_soon([&ran] { ran = true; });
+    co_return;
+}
+
+static kuro::task<void> yield_once()
+{
+    co_await kuro::yield();
+}
+
+static kuro::task<bool> destroy_while_yielded()
+{
+    bool resumed = false;
+    {
+        auto yielded = kuro::event_loop::create_task(set_after_yield(resumed));
+    }
+    co_await kuro::yield();
+    co_return resumed;
+}
+
+// Pops until another task gets to run, which only happens if the time slice
+// makes the pops yield, since they never need to suspend.
+static kuro::task<int> pop_until_preempted(int n)
+{
+    kuro::queue<int> q;
+    for (int i = 0; i < n; ++i) {
+        q.push(i);
+    }
+
+    bool preempted = false;
+    auto other = kuro::event_loop::create_task(set_after_yield(preempted));
+    int popped = 0;
+    while (!preempted && popped < n) {
+        co_await q.pop();
+        ++popped;
+    }
+    co_await other;
+    co_return popped;
+}
+
+static kuro::task<int> pop_one(kuro::queue<int>& q)
+{
+    co_return co_await q.pop();
+}
+
+// Both pops are yielded while a single item is queued, so the second one
+// must not take it for granted once it gets to run.
+static kuro::task<int> contended_pops()
+{
+    kuro::queue<int> q;
+    q.push(1);
+    auto a = kuro::event_loop::create_task(pop_one(q));
+    auto b = kuro::event_loop::create_task(pop_one(q));
+    co_await kuro::yield();
+    q.push(2);
+    auto first = co_await a;
+    auto second = co_await b;
+    co_return first * 10 + second;
+}
+
+TEST_CASE("event_loop")
+{
+    kuro::event_loop::run(schedule_callbacks());
+    REQUIRE(order == std::vector<int>{1, 2, 3});
+
+    auto [cancelled, value] = kuro::event_loop::run(cancel_then_push());
+    REQUIRE(!cancelled);
+    REQUIRE(value == 10);
+
+    auto [woken, slept_for] = kuro::event_loop::run(sleep_many());
+    REQUIRE(woken == std::vector<int>{0, 3, 20, 70});
+    REQUIRE(slept_for >= std::chrono::milliseconds(70));
+
+    auto empty_polls = kuro::event_loop::stats().empty_busy_polls;
+    kuro::event_loop::run(busy_sleep());
+    REQUIRE(kuro::event_loop::stats().empty_busy_polls > empty_polls);
+    REQUIRE(kuro::event_loop::stats().busy_polls >= kuro::event_loop::stats().empty_busy_polls);
+
+    bool ran = false;
+    kuro::event_loop::run(leave_callback(ran));
+    kuro::event_loop::run(yield_once());
+    REQUIRE(!ran);
+
+    REQUIRE(kuro::event_loop::run(threadsafe_submission()) == std::pair{100, 42});
+
+    REQUIRE(kuro::event_loop::run(offload_blocking_work()));
+
+    REQUIRE(timeout_on_saturated_pool());
+
+    REQUIRE(drain_pool_on_shutdown() == 16);
+    REQUIRE(withdraw_from_pool() == 4);
+
+    REQUIRE(far_timer_timeout() == std::numeric_limits<int>::max());
+}
+
+TEST_CASE("time_slice")
+{
+    REQUIRE(kuro::event_loop::run(interleave()) == std::vector<int>{10, 20, 11, 21, 12, 22});
+
+    REQUIRE(!kuro::event_loop::run(destroy_while_yielded()));
+
+    REQUIRE(kuro::event_loop::run(pop_until_preempted(1000)) == 1000);
+
+    kuro::event_loop::set_time_slice(std::chrono::microseconds(0), 8);
+    REQUIRE(kuro::event_loop::run(pop_until_preempted(1000)) <= 8);
+
+    kuro::event_loop::set_time_slice(std::chrono::microseconds(0), 1);
+    REQUIRE(kuro::event_loop::run(contended_pops()) == 12);
+
+    kuro::event_loop::set_time_slice(std::chrono::microseconds(0));
+}
+
+TEST_CASE("memory_resource")
+{
+    counting_resource resource;
+    int sum = 0;
+    bool rejected_late = false;
+    std::jthread([&] {
+        kuro::event_loop::set_memory_resource(&resource);
+        sum = kuro::event_loop::run(pmr_queue(&resource));
+        try {
+            kuro::event_loop::set_memory_resource(&resource);
+        } catch (const std::logic_error&) {
+            rejected_late = true;
+        }
+    }).join();
+    REQUIRE(sum == 3);
+    REQUIRE(resource.allocations >= 3);
+    REQUIRE(rejected_late);
+}
\ No newline at end of file
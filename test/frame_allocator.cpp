@@ -0,0 +1,105 @@
+#include <cstdlib>
+#include <thread>
+
+#include "catch.hpp"
+#include "kuro/kuro.hpp"
+
+static kuro::task<int> leaf(int i)
+{
+    co_return i;
+}
+
+static kuro::task<int> sum_leaves()
+{
+    int sum = 0;
+    for (int i = 0; i < 100; ++i) {
+        sum += co_await leaf(i);
+    }
+    co_return sum;
+}
+
+static kuro::task<int> arena_leaf(std::allocator_arg_t, kuro::arena&, int i)
+{
+    co_return i;
+}
+
+static kuro::task<int> arena_sum(std::allocator_arg_t, kuro::arena&, int a, int b, int c, int d, int e, int f)
+{
+    co_return a + b + c + d + e + f;
+}
+
+static kuro::task<int> sum_arena_leaves(std::allocator_arg_t, kuro::arena& a)
+{
+    int sum = 0;
+    for (int i = 0; i < 100; ++i) {
+        sum += co_await arena_leaf(std::allocator_arg, a, i);
+    }
+    co_return sum;
+}
+
+static int hooked_allocations = 0;
+
+static void* hooked_allocate(std::size_t size)
+{
+    ++hooked_allocations;
+    return std::malloc(size);
+}
+
+static void hooked_deallocate(void* ptr, std::size_t)
+{
+    std::free(ptr);
+}
+
+TEST_CASE("frame_allocator")
+{
+    // Constructs the thread's loop, whose own frames aren't counted below.
+    kuro::event_loop::stats();
+    auto before = kuro::frame_allocator::stats();
+    REQUIRE(kuro::event_loop::run(sum_leaves()) == 4950);
+    auto after = kuro::frame_allocator::stats();
+    REQUIRE(after.hits - before.hits >= 99);
+    REQUIRE(after.misses - before.misses <= 3);
+
+    // Allocated from the pool, so it must be freed there after the switch.
+    auto pooled = sum_leaves();
+    auto hooked = kuro::frame_allocator::stats();
+    kuro::frame_allocator::set_hooks({hooked_allocate, hooked_deallocate});
+    REQUIRE(kuro::event_loop::run(sum_leaves()) == 4950);
+    REQUIRE(kuro::event_loop::run(std::move(pooled)) == 4950);
+    kuro::frame_allocator::set_hooks({});
+    REQUIRE(hooked_allocations >= 101);
+    REQUIRE(kuro::frame_allocator::stats().hits == hooked.hits);
+    REQUIRE_THROWS_AS(kuro::frame_allocator::set_hooks({hooked_allocate, nullptr}), std::invalid_argument);
+}
+
+TEST_CASE("arena_frames")
+{
+    static_assert(!kuro::detail::misplaced_arena<std::allocator_arg_t, kuro::arena, int, int, int, int, int, int>);
+    static_assert(!kuro::detail::misplaced_arena<int, std::allocator_arg_t, kuro::arena, int, int, int, int>);
+    static_assert(!kuro::detail::misplaced_arena<int, std::allocator_arg_t, kuro::arena, int, int, int, int, int, int>);
+    static_assert(kuro::detail::misplaced_arena<std::allocator_arg_t, kuro::arena, int, int, int, int, int, int, int, int, int>);
+    static_assert(kuro::detail::misplaced_arena<int, int, std::allocator_arg_t, kuro::arena>);
+    static_assert(kuro::detail::misplaced_arena<std::allocator_arg_t, const kuro::arena>);
+
+    kuro::arena a;
+    auto before = kuro::frame_allocator::stats();
+    REQUIRE(kuro::event_loop::run(sum_arena_leaves(std::allocator_arg, a)) == 4950);
+    auto after = kuro::frame_allocator::stats();
+    REQUIRE(after.hits - before.hits <= 3);
+    REQUIRE(a.used() >= 101 * sizeof(int));
+
+    auto used = a.used();
+    REQUIRE(kuro::event_loop::run(arena_sum(std::allocator_arg, a, 1, 2, 3, 4, 5, 6)) == 21);
+    REQUIRE(a.used() > used);
+
+    a.release();
+    REQUIRE(a.used() == 0);
+}
+
+TEST_CASE("frame_allocator_foreign_frees")
+{
+    // Cached by a thread that never allocates a frame itself, which must
+    // still release its cache when it exits.
+    auto frame = sum_leaves();
+    std::thread([f = std::move(frame)] {}).join();
+}
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include <memory>
+#include <vector>
 
 #include "catch.hpp"
 #include "kuro/kuro.hpp"
@@ -51,4 +52,236 @@ TEST_CASE("gather")
     REQUIRE(*b == 20);
     REQUIRE(&c == &global);
     REQUIRE(e == 40);
+}
+
+static kuro::task<int> square_after(int i)
+{
+    co_await kuro::sleep_for(std::chrono::nanoseconds(i));
+    co_return i * i;
+}
+
+static std::uint64_t frames()
+{
+    auto stats = kuro::frame_allocator::stats();
+    return stats.hits + stats.misses;
+}
+
+static kuro::task<std::pair<std::vector<int>, std::uint64_t>> gather_range()
+{
+    std::vector<kuro::task<int>> tasks;
+    for (int i = 5; i > 0; --i) {
+        tasks.push_back(square_after(i));
+    }
+    tasks.push_back(return_10());
+
+    auto before = frames();
+    auto results = co_await kuro::gather(tasks);
+    co_return {std::move(results), frames() - before};
+}
+
+static kuro::shared_task<int> shared_square_after(int i)
+{
+    co_await kuro::sleep_for(std::chrono::nanoseconds(i));
+    co_return i * i;
+}
+
+static kuro::task<std::pair<std::vector<int>, std::uint64_t>> gather_shared_range()
+{
+    std::vector<kuro::shared_task<int>> tasks;
+    for (int i = 3; i > 0; --i) {
+        tasks.push_back(shared_square_after(i));
+    }
+
+    auto before = frames();
+    auto results = co_await kuro::gather(tasks);
+    auto n_frames = frames() - before;
+    co_return {std::vector<int>(results.begin(), results.end()), n_frames};
+}
+
+static kuro::task<std::size_t> gather_empty_range()
+{
+    std::vector<kuro::task<int>> tasks;
+    auto results = co_await kuro::gather(tasks);
+    co_return results.size();
+}
+
+static std::vector<kuro::task<int>> make_tasks()
+{
+    std::vector<kuro::task<int>> tasks;
+    for (int i = 3; i > 0; --i) {
+        tasks.push_back(square_after(i));
+    }
+    return tasks;
+}
+
+// The gather takes the tasks over from the temporary vector.
+static kuro::task<std::vector<int>> gather_temporary_range()
+{
+    auto g = kuro::gather(make_tasks());
+    co_return co_await g;
+}
+
+TEST_CASE("gather_range")
+{
+    auto [results, n_frames] = kuro::event_loop::run(gather_range());
+    REQUIRE(results == std::vector<int>{25, 16, 9, 4, 1, 10});
+    // The tasks notify the gather directly, so it allocates no frame,
+    // although it can be cancelled.
+    REQUIRE(n_frames == 0);
+
+    // Shared tasks resume a single pooled frame, which counts their
+    // completions.
+    auto [shared_results, shared_frames] = kuro::event_loop::run(gather_shared_range());
+    REQUIRE(shared_results == std::vector<int>{9, 4, 1});
+    REQUIRE(shared_frames == 1);
+    REQUIRE(kuro::event_loop::run(gather_empty_range()) == 0);
+    REQUIRE(kuro::event_loop::run(gather_temporary_range()) == std::vector<int>{9, 4, 1});
+}
+
+// Counts how often it is cancelled.
+class counted_wait
+{
+public:
+    counted_wait(kuro::event<>& ev, int& cancels) : m_wait(ev.wait()), m_cancels(cancels) {}
+    bool await_ready()
+    {
+        return m_wait.await_ready();
+    }
+    void await_suspend(std::coroutine_handle<> handle)
+    {
+        m_wait.await_suspend(handle);
+    }
+    void await_resume() {}
+    void await_cancel()
+    {
+        ++m_cancels;
+        m_wait.await_cancel();
+    }
+
+private:
+    decltype(std::declval<kuro::event<>&>().wait()) m_wait;
+    int& m_cancels;
+};
+
+static kuro::task<int> cancel_pending_only()
+{
+    kuro::event<> done;
+    kuro::event<> never;
+    int cancels = 0;
+    kuro::event_loop::call_soon([&] { done.set(); });
+    auto gathered = co_await kuro::with_timeout(
+        kuro::gather(counted_wait(done, cancels), counted_wait(never, cancels)),
+        std::chrono::milliseconds(1)
+    );
+    co_return gathered ? -1 : cancels;
+}
+
+// Its cancellation only takes effect once the event is set.
+class deferred_wait
+{
+public:
+    deferred_wait(kuro::event<>& ev) : m_wait(ev.wait()) {}
+    bool await_ready()
+    {
+        return m_wait.await_ready();
+    }
+    void await_suspend(std::coroutine_handle<> handle)
+    {
+        m_wait.await_suspend(handle);
+    }
+    void await_resume() {}
+    bool await_cancel()
+    {
+        m_cancelled = true;
+        return false;
+    }
+    bool await_cancelled() const
+    {
+        return m_cancelled;
+    }
+
+private:
+    decltype(std::declval<kuro::event<>&>().wait()) m_wait;
+    bool m_cancelled = false;
+};
+
+static kuro::task<std::vector<int>> wait_for_deferred()
+{
+    std::vector<int> seen;
+    kuro::event<> gathered_ev;
+    kuro::event_loop::call_later(std::chrono::milliseconds(5), [&] { gathered_ev.set(); });
+    auto gathered = co_await kuro::with_timeout(
+        kuro::gather(deferred_wait(gathered_ev), kuro::sleep_for(std::chrono::seconds(10))),
+        std::chrono::milliseconds(1)
+    );
+    seen.push_back(gathered.has_value());
+    seen.push_back(gathered_ev.is_set());
+
+    kuro::event<> raced_ev;
+    kuro::event_loop::call_later(std::chrono::milliseconds(5), [&] { raced_ev.set(); });
+    auto winner = co_await kuro::when_any(kuro::sleep_for(std::chrono::milliseconds(1)), deferred_wait(raced_ev));
+    seen.push_back(winner.index());
+    seen.push_back(raced_ev.is_set());
+    co_return seen;
+}
+
+TEST_CASE("gather_cancel")
+{
+    REQUIRE(kuro::event_loop::run(cancel_pending_only()) == 1);
+    REQUIRE(kuro::event_loop::run(wait_for_deferred()) == std::vector<int>{0, 1, 0, 1});
+}
+
+static kuro::task<int> set_after(bool& flag, std::chrono::milliseconds delay)
+{
+    co_await kuro::sleep_for(delay);
+    flag = true;
+    co_return 0;
+}
+
+static kuro::task<std::pair<std::size_t, int>> race()
+{
+    bool slow_finished = false;
+    kuro::queue<int> q;
+    auto winner = co_await kuro::when_any(
+        set_after(slow_finished, std::chrono::milliseconds(1)),
+        sleep_and_return(),
+        q.pop()
+    );
+    co_await kuro::sleep_for(std::chrono::milliseconds(5));
+    co_return {winner.index(), slow_finished ? -1 : std::get<1>(winner)};
+}
+
+static kuro::task<std::size_t> race_ready()
+{
+    kuro::queue<int> q;
+    q.push(1);
+    auto sync = co_await kuro::when_any(return_10(), kuro::sleep_for(std::chrono::seconds(10)));
+    auto ready = co_await kuro::when_any(kuro::sleep_for(std::chrono::seconds(10)), q.pop());
+    co_return sync.index() * 10 + ready.index();
+}
+
+// Returns the winner and the frames the race took beyond the tasks' own.
+static kuro::task<std::pair<std::size_t, std::uint64_t>> race_frames(bool with_sleep)
+{
+    bool slow_finished = false;
+    bool fast_finished = false;
+    auto slow = set_after(slow_finished, std::chrono::milliseconds(20));
+    auto fast = set_after(fast_finished, std::chrono::milliseconds(1));
+    auto before = frames();
+    if (with_sleep) {
+        auto winner = co_await kuro::when_any(slow, fast, kuro::sleep_for(std::chrono::seconds(10)));
+        co_return {winner.index(), frames() - before};
+    }
+    auto winner = co_await kuro::when_any(slow, fast);
+    co_return {winner.index(), frames() - before};
+}
+
+TEST_CASE("when_any")
+{
+    REQUIRE(kuro::event_loop::run(race()) == std::pair<std::size_t, int>{1, 40});
+    REQUIRE(kuro::event_loop::run(race_ready()) == 1);
+
+    // The tasks share one frame, and the sleep takes a frame of its own.
+    REQUIRE(kuro::event_loop::run(race_frames(false)) == std::pair<std::size_t, std::uint64_t>{1, 1});
+    REQUIRE(kuro::event_loop::run(race_frames(true)) == std::pair<std::size_t, std::uint64_t>{1, 2});
 }
\ No newline at end of file
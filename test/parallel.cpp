@@ -0,0 +1,125 @@
+#include <atomic>
+#include <numeric>
+#include <optional>
+#include <ranges>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "catch.hpp"
+#include "kuro/kuro.hpp"
+
+static kuro::task<std::vector<int>> increment_all()
+{
+    std::vector<int> values(1000);
+    std::iota(values.begin(), values.end(), 0);
+    co_await kuro::parallel_for(values, 64, [](int& v) { ++v; });
+    co_return values;
+}
+
+static kuro::task<std::vector<long>> squares()
+{
+    co_return co_await kuro::parallel_transform(std::views::iota(0, 100), 7, [](int i) { return long(i) * i; });
+}
+
+static kuro::task<bool> resumes_on_loop()
+{
+    auto loop_thread = std::this_thread::get_id();
+    std::vector<int> empty;
+    co_await kuro::parallel_for(empty, 1, [](int) {});
+    auto ids = co_await kuro::parallel_transform(std::views::iota(0, 8), 1, [](int) {
+        return std::this_thread::get_id();
+    });
+    co_return std::this_thread::get_id() == loop_thread
+        && std::none_of(ids.begin(), ids.end(), [&](auto id) { return id == loop_thread; });
+}
+
+static kuro::task<void> throw_in_chunk()
+{
+    co_await kuro::parallel_for(std::views::iota(0, 100), 10, [](int i) {
+        if (i == 42) {
+            throw std::runtime_error("failed");
+        }
+    });
+}
+
+static kuro::task<std::pair<bool, bool>> cancel_chunks()
+{
+    std::atomic<int> processed = 0;
+    auto cancelled = co_await kuro::with_timeout(
+        kuro::parallel_for(std::views::iota(0, 1000), 1, [&](int) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            ++processed;
+        }),
+        std::chrono::milliseconds(5)
+    );
+    int seen = processed;
+    co_await kuro::sleep_for(std::chrono::milliseconds(5));
+    co_return {!cancelled && processed < 1000, processed == seen};
+}
+
+// Cancelled once both chunks run, so they complete and the result is
+// returned.
+static kuro::task<std::optional<std::vector<int>>> cancel_running_chunks()
+{
+    auto& loop = kuro::event_loop::current();
+    kuro::cancellation cancel;
+    std::atomic<int> started = 0;
+    co_return co_await kuro::with_cancellation(
+        kuro::parallel_transform(std::views::iota(0, 2), 1, [&](int i) {
+            if (++started == 2) {
+                loop.post([&] { cancel.trigger(); });
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            return i;
+        }),
+        cancel
+    );
+}
+
+static kuro::task<std::vector<bool>> transform_to_bool()
+{
+    co_return co_await kuro::parallel_transform(std::views::iota(0, 4), 1, [](int i) { return i % 2 == 0; });
+}
+
+static kuro::task<void> fan_out(std::atomic<int>& processed)
+{
+    co_await kuro::parallel_for(std::views::iota(0, 1000), 1, [&](int) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        ++processed;
+    });
+}
+
+static kuro::task<bool> destroy_during_fan_out()
+{
+    std::atomic<int> processed = 0;
+    {
+        kuro::task_group group;
+        co_await group.spawn(fan_out(processed));
+        co_await kuro::sleep_for(std::chrono::milliseconds(5));
+    }
+    int seen = processed;
+    co_await kuro::sleep_for(std::chrono::milliseconds(5));
+    co_return processed < 1000 && processed == seen;
+}
+
+TEST_CASE("parallel")
+{
+    auto values = kuro::event_loop::run(increment_all());
+    std::vector<int> expected(1000);
+    std::iota(expected.begin(), expected.end(), 1);
+    REQUIRE(values == expected);
+
+    auto result = kuro::event_loop::run(squares());
+    REQUIRE(result.size() == 100);
+    for (long i = 0; i < 100; ++i) {
+        REQUIRE(result[i] == i * i);
+    }
+
+    REQUIRE(kuro::event_loop::run(resumes_on_loop()));
+    REQUIRE_THROWS_AS(kuro::event_loop::run(throw_in_chunk()), std::runtime_error);
+    REQUIRE(kuro::event_loop::run(cancel_chunks()) == std::pair{true, true});
+    REQUIRE(kuro::event_loop::run(cancel_running_chunks()) == std::vector<int>{0, 1});
+    REQUIRE(kuro::event_loop::run(transform_to_bool()) == std::vector<bool>{true, false, true, false});
+    REQUIRE(kuro::event_loop::run(destroy_during_fan_out()));
+}
\ No newline at end of file
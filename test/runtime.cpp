@@ -0,0 +1,93 @@
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "catch.hpp"
+#include "kuro/kuro.hpp"
+
+static kuro::task<std::size_t> square(std::size_t shard)
+{
+    co_await kuro::sleep_for(std::chrono::milliseconds(1));
+    co_return shard * shard;
+}
+
+static kuro::task<std::thread::id> thread_id()
+{
+    co_return std::this_thread::get_id();
+}
+
+static kuro::task<void> fail_first(std::size_t shard)
+{
+    auto delay = shard == 0 ? std::chrono::milliseconds(1) : std::chrono::milliseconds(std::chrono::hours(1));
+    co_await kuro::sleep_for(delay);
+    if (shard == 0) {
+        throw std::runtime_error("shard failed");
+    }
+}
+
+static std::atomic<int> started = 0;
+static std::atomic<int> unwound = 0;
+static std::atomic<bool> failed = false;
+
+// Shard 0 fails only once every other shard's offloaded call has started,
+// so that none of them can be skipped by the cancellation.
+static kuro::task<void> fail_while_others_block(std::size_t shard)
+{
+    if (shard == 0) {
+        while (started < 3) {
+            co_await kuro::sleep_for(std::chrono::milliseconds(1));
+        }
+        failed = true;
+        throw std::runtime_error("shard failed");
+    }
+    try {
+        co_await kuro::run_in_executor([] {
+            ++started;
+            while (!failed) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        });
+        co_await kuro::sleep_for(std::chrono::hours(1));
+    } catch (const kuro::task_cancelled&) {
+        ++unwound;
+        throw;
+    }
+}
+
+static kuro::task<int> connect_shared_port()
+{
+    kuro::tcpv4_listen_socket a(kuro::ipv4_address::loopback(), 0, 16, true);
+    kuro::tcpv4_listen_socket b(kuro::ipv4_address::loopback(), a.port(), 16, true);
+    auto client = kuro::ipv4_socket::tcp();
+    co_return co_await client.connect(kuro::ipv4_address::loopback(), b.port());
+}
+
+TEST_CASE("runtime")
+{
+    kuro::runtime rt(4);
+    REQUIRE(rt.run(square) == std::vector<std::size_t>{0, 1, 4, 9});
+
+    auto ids = rt.run(thread_id);
+    REQUIRE(ids.size() == 4);
+    for (auto id : ids) {
+        REQUIRE(id != std::this_thread::get_id());
+        REQUIRE(std::count(ids.begin(), ids.end(), id) == 1);
+    }
+
+    REQUIRE_THROWS_AS(rt.run([]() -> kuro::task<void> {
+        throw std::runtime_error("shard failed");
+        co_return;
+    }), std::runtime_error);
+
+    auto start = std::chrono::steady_clock::now();
+    REQUIRE_THROWS_AS(rt.run(fail_first), std::runtime_error);
+    REQUIRE(std::chrono::steady_clock::now() - start < std::chrono::minutes(1));
+
+    REQUIRE_THROWS_AS(rt.run(fail_while_others_block), std::runtime_error);
+    REQUIRE(started == 3);
+    REQUIRE(unwound == 3);
+
+    REQUIRE(kuro::event_loop::run(connect_shared_port()) == 0);
+}
@@ -0,0 +1,369 @@
+#include <future>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "catch.hpp"
+#include "kuro/kuro.hpp"
+
+using namespace std::literals;
+
+static constexpr auto stream_addr = "\0kuro_test_stream"sv;
+static constexpr auto dgram_addr_a = "\0kuro_test_dgram_a"sv;
+static constexpr auto dgram_addr_b = "\0kuro_test_dgram_b"sv;
+static constexpr auto dgram_addr_c = "\0kuro_test_dgram_c"sv;
+static constexpr auto unbound_addr = "\0kuro_test_unbound"sv;
+
+static kuro::task<void> echo(kuro::unix_listen_socket& listener)
+{
+    auto sock = co_await listener.accept();
+    char buf[16];
+    auto n_bytes = co_await sock.recv(buf, sizeof(buf));
+    co_await sock.send(buf, n_bytes);
+}
+
+static kuro::task<std::string> stream_roundtrip()
+{
+    kuro::unix_listen_socket listener(stream_addr);
+    auto server = kuro::event_loop::create_task(echo(listener));
+
+    auto client = kuro::unix_socket::stream();
+    co_await client.connect(stream_addr);
+    auto msg = "hello"sv;
+    co_await client.send(msg.data(), msg.size());
+
+    char buf[16];
+    auto n_bytes = co_await client.recv(buf, sizeof(buf));
+    co_await server;
+    co_return std::string(buf, n_bytes);
+}
+
+static kuro::task<std::pair<std::string, std::string>> dgram_roundtrip()
+{
+    auto a = kuro::unix_socket::bound_dgram(dgram_addr_a);
+    auto b = kuro::unix_socket::bound_dgram(dgram_addr_b);
+    auto msg = "ping"sv;
+    co_await a.sendto(msg.data(), msg.size(), dgram_addr_b);
+
+    char buf[16];
+    auto [n_bytes, sender] = co_await b.recvfrom(buf, sizeof(buf));
+    co_return {std::string(buf, n_bytes), sender};
+}
+
+static kuro::task<bool> accept_timeout()
+{
+    kuro::unix_listen_socket listener(stream_addr);
+    auto sock = co_await kuro::with_timeout(listener.accept(), std::chrono::milliseconds(1));
+    co_return sock.has_value();
+}
+
+// The listener's backlog holds a single connection, so the second connect
+// fails with EAGAIN, also once it has been retried.
+static kuro::task<int> connect_full_backlog()
+{
+    kuro::unix_listen_socket listener(stream_addr, 0);
+    auto first = kuro::unix_socket::stream();
+    co_await first.connect(stream_addr);
+    auto second = kuro::unix_socket::stream();
+    try {
+        co_await second.connect(stream_addr);
+    } catch (const std::system_error& e) {
+        co_return e.code().value();
+    }
+    co_return 0;
+}
+
+static kuro::task<kuro::ipv6_socket> accept_v6(kuro::tcpv6_listen_socket& listener)
+{
+    co_return co_await listener.accept();
+}
+
+static kuro::task<std::string> tcpv6_roundtrip()
+{
+    kuro::tcpv6_listen_socket listener(kuro::ipv6_address::loopback(), 0);
+    auto accepted = kuro::event_loop::create_task(accept_v6(listener));
+
+    auto client = kuro::ipv6_socket::tcp();
+    co_await client.connect(kuro::ipv6_address::loopback(), listener.port());
+    auto server = co_await accepted;
+    auto msg = "hello"sv;
+    co_await client.send(msg.data(), msg.size());
+
+    char buf[16];
+    auto n_bytes = co_await server.recv(buf, sizeof(buf));
+    co_return std::string(buf, n_bytes);
+}
+
+static kuro::task<void> arena_echo(std::allocator_arg_t, kuro::arena& a, kuro::socket sock)
+{
+    auto buf = a.allocate_array<char>(16);
+    auto n_bytes = co_await sock.recv(buf, 16);
+    co_await sock.send(buf, n_bytes);
+}
+
+static kuro::task<std::string> arena_roundtrip()
+{
+    kuro::unix_listen_socket listener(stream_addr);
+    kuro::cancellation cancel;
+    auto server = kuro::event_loop::create_task(listener.serve_forever(arena_echo, cancel));
+
+    auto client = kuro::unix_socket::stream();
+    co_await client.connect(stream_addr);
+    auto msg = "arena"sv;
+    co_await client.send(msg.data(), msg.size());
+
+    char buf[16];
+    auto n_bytes = co_await client.recv(buf, sizeof(buf));
+    cancel.trigger();
+    co_await server;
+    co_return std::string(buf, n_bytes);
+}
+
+static kuro::task<void> cancel_on_recv(kuro::unix_socket& sock, kuro::cancellation& cancel)
+{
+    char buf[16];
+    co_await sock.recvfrom(buf, sizeof(buf));
+    cancel.trigger();
+}
+
+static kuro::task<bool> accept_until(kuro::unix_listen_socket& listener, kuro::cancellation& cancel)
+{
+    auto sock = co_await kuro::with_cancellation(listener.accept(), cancel);
+    co_return sock.has_value();
+}
+
+// The accept can complete in the same batch as the receive that cancels it,
+// in which case the connection must be returned or closed, not leaked.
+static kuro::task<bool> cancel_completed_accept()
+{
+    auto client = kuro::unix_socket::stream();
+    {
+        kuro::unix_listen_socket listener(stream_addr);
+        co_await client.connect(stream_addr);
+        auto a = kuro::unix_socket::bound_dgram(dgram_addr_a);
+        auto b = kuro::unix_socket::bound_dgram(dgram_addr_b);
+        co_await a.sendto("x", 1, dgram_addr_b);
+
+        kuro::cancellation cancel;
+        auto trigger = kuro::event_loop::create_task(cancel_on_recv(b, cancel));
+        auto accepted = kuro::event_loop::create_task(accept_until(listener, cancel));
+        co_await trigger;
+        co_await accepted;
+    }
+
+    char buf[16];
+    auto hangup = co_await kuro::with_timeout(kuro::as_result(client.recv(buf, sizeof(buf))), std::chrono::seconds(1));
+    co_return hangup.has_value();
+}
+
+static kuro::task<std::size_t> recv_until(kuro::unix_socket& sock, char* buf, kuro::cancellation& cancel)
+{
+    auto received = co_await kuro::with_cancellation(sock.recvfrom(buf, 16), cancel);
+    if (!received) {
+        received = co_await sock.recvfrom(buf, 16);
+    }
+    co_return received->first;
+}
+
+// A datagram that is already queued when the receive is cancelled is
+// either returned by it or left for the next receive, never dropped.
+static kuro::task<std::string> cancel_racing_recv()
+{
+    auto a = kuro::unix_socket::bound_dgram(dgram_addr_a);
+    auto b = kuro::unix_socket::bound_dgram(dgram_addr_b);
+    co_await a.sendto("x", 1, dgram_addr_b);
+
+    char buf[16];
+    kuro::cancellation cancel;
+    auto received = kuro::event_loop::create_task(recv_until(b, buf, cancel));
+    cancel.trigger();
+    auto n_bytes = co_await received;
+    co_return std::string(buf, n_bytes);
+}
+
+static kuro::eager_task<void> recv_forever(kuro::unix_socket& sock)
+{
+    char buf[16];
+    co_await sock.recv(buf, sizeof(buf));
+}
+
+static kuro::task<void> recv_then_destroy(kuro::unix_socket& sock, std::optional<kuro::eager_task<void>>& pending)
+{
+    char buf[16];
+    co_await sock.recv(buf, sizeof(buf));
+    pending.reset();
+}
+
+static kuro::task<std::size_t> recv_one(kuro::unix_socket& sock)
+{
+    char buf[16];
+    co_return co_await sock.recv(buf, sizeof(buf));
+}
+
+// Wraps a descriptor of the test's own, e.g. a dup of another socket's.
+struct raw_socket : kuro::socket
+{
+    explicit raw_socket(int fd) : socket(fd) {}
+};
+
+static kuro::task<std::size_t> recv_any(kuro::socket& sock)
+{
+    char buf[16];
+    co_return co_await sock.recv(buf, sizeof(buf));
+}
+
+// Both descriptors of the same socket are woken by the first datagram, and
+// the one that loses the race for it keeps waiting instead of failing with
+// EAGAIN.
+static kuro::task<std::size_t> recv_on_dup()
+{
+    int fds[2];
+    kuro::detail::check_error(socketpair(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK, 0, fds));
+    raw_socket writer(fds[0]);
+    raw_socket first(fds[1]);
+    raw_socket second(kuro::detail::check_fd(dup(fds[1])));
+
+    auto a = kuro::event_loop::create_task(recv_any(first));
+    auto b = kuro::event_loop::create_task(recv_any(second));
+    co_await kuro::yield();
+    co_await writer.send("x", 1);
+    co_await kuro::sleep_for(std::chrono::milliseconds(1));
+    co_await writer.send("yz", 2);
+    co_return co_await a + co_await b;
+}
+
+// Destroying a frame with a pending operation waits for its completion,
+// which must not disturb the completions being resumed around it.
+static kuro::task<std::size_t> destroy_during_completions()
+{
+    auto a = kuro::unix_socket::bound_dgram(dgram_addr_a);
+    auto b = kuro::unix_socket::bound_dgram(dgram_addr_b);
+    auto c = kuro::unix_socket::bound_dgram(dgram_addr_c);
+    auto idle = kuro::unix_socket::dgram();
+    std::optional<kuro::eager_task<void>> pending(recv_forever(idle));
+
+    auto first = kuro::event_loop::create_task(recv_then_destroy(b, pending));
+    auto second = kuro::event_loop::create_task(recv_one(c));
+    co_await kuro::yield();
+    co_await kuro::gather(a.sendto("x", 1, dgram_addr_b), a.sendto("yz", 2, dgram_addr_c));
+    co_await first;
+    co_return co_await second;
+}
+
+#ifdef KURO_USE_IO_URING
+static kuro::task<kuro::unix_socket> accept_one(kuro::unix_listen_socket& listener)
+{
+    co_return co_await listener.accept();
+}
+
+static kuro::task<std::size_t> send_one(kuro::unix_socket& sock)
+{
+    co_return co_await sock.send("x", 1);
+}
+
+static kuro::task<std::size_t> recv_all(kuro::unix_socket& sock, std::size_t n_bytes)
+{
+    char buf[256];
+    std::size_t received = 0;
+    while (received < n_bytes) {
+        received += co_await sock.recv(buf, sizeof(buf));
+    }
+    co_return received;
+}
+
+// Starts more operations in one go than the submission queue holds, and
+// more than fit in the completion queue, none of which may be dropped.
+static kuro::task<std::size_t> overfill_submissions()
+{
+    constexpr std::size_t n_sends = 2000;
+    kuro::unix_listen_socket listener(stream_addr);
+    auto accepted = kuro::event_loop::create_task(accept_one(listener));
+    auto client = kuro::unix_socket::stream();
+    co_await client.connect(stream_addr);
+    auto server = co_await accepted;
+    auto received = kuro::event_loop::create_task(recv_all(server, n_sends));
+
+    std::vector<kuro::task<std::size_t>> sends;
+    for (std::size_t i = 0; i < n_sends; ++i) {
+        sends.push_back(send_one(client));
+    }
+    std::size_t sent = 0;
+    for (auto n_bytes : co_await kuro::gather(sends)) {
+        sent += n_bytes;
+    }
+    co_return sent == co_await received ? sent : 0;
+}
+#endif
+
+static kuro::task<kuro::result<int>> refused_connect()
+{
+    auto client = kuro::unix_socket::stream();
+    co_return co_await kuro::as_result(client.connect(unbound_addr));
+}
+
+static kuro::task<int> refused_connect_throws()
+{
+    auto client = kuro::unix_socket::stream();
+    co_return co_await client.connect(unbound_addr);
+}
+
+static kuro::task<kuro::result<void>> double_bind()
+{
+    kuro::unix_listen_socket a(stream_addr);
+    kuro::unix_listen_socket b(stream_addr);
+    co_return {};
+}
+
+// On a new thread, which must not get a loop just to close the socket.
+static bool close_without_loop()
+{
+    return std::async(std::launch::async, [] {
+        {
+            auto sock = kuro::ipv4_socket::tcp();
+        }
+        try {
+            kuro::event_loop::set_memory_resource(kuro::detail::loop_resource());
+            return true;
+        } catch (const std::logic_error&) {
+            return false;
+        }
+    }).get();
+}
+
+TEST_CASE("socket")
+{
+    REQUIRE(kuro::event_loop::run(stream_roundtrip()) == "hello");
+
+    auto [msg, sender] = kuro::event_loop::run(dgram_roundtrip());
+    REQUIRE(msg == "ping");
+    REQUIRE(sender == dgram_addr_a);
+
+    REQUIRE(!kuro::event_loop::run(accept_timeout()));
+    REQUIRE(kuro::event_loop::run(tcpv6_roundtrip()) == "hello");
+    REQUIRE(kuro::event_loop::run(connect_full_backlog()) == EAGAIN);
+    REQUIRE(kuro::event_loop::run(arena_roundtrip()) == "arena");
+    REQUIRE(kuro::event_loop::run(cancel_completed_accept()));
+    REQUIRE(kuro::event_loop::run(cancel_racing_recv()) == "x");
+    REQUIRE(kuro::event_loop::run(destroy_during_completions()) == 2);
+    REQUIRE(close_without_loop());
+    REQUIRE(kuro::event_loop::run(recv_on_dup()) == 3);
+#ifdef KURO_USE_IO_URING
+    REQUIRE(kuro::event_loop::run(overfill_submissions()) == 2000);
+#endif
+}
+
+TEST_CASE("socket_result")
+{
+    auto connected = kuro::event_loop::run(refused_connect());
+    REQUIRE(!connected);
+    REQUIRE(connected.error() == std::errc::connection_refused);
+
+    REQUIRE_THROWS_AS(connected.value(), std::system_error);
+    REQUIRE_THROWS_AS(kuro::event_loop::run(refused_connect_throws()), std::system_error);
+    REQUIRE_THROWS_AS(kuro::event_loop::run(double_bind()), std::system_error);
+}
\ No newline at end of file
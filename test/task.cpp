@@ -1,4 +1,7 @@
+#include <atomic>
 #include <memory>
+#include <thread>
+#include <vector>
 
 #include "catch.hpp"
 #include "kuro/kuro.hpp"
@@ -31,6 +34,25 @@ static kuro::task<void> modify_global_return_void()
     co_return;
 }
 
+// Takes the awaiting frame's handle with its promise type.
+struct promise_awaitable
+{
+    bool await_ready() { return false; }
+    bool await_suspend(std::coroutine_handle<kuro::task<int>::promise_type> handle)
+    {
+        promise = &handle.promise();
+        return false;
+    }
+    bool await_resume() { return promise != nullptr; }
+
+    kuro::task<int>::promise_type* promise = nullptr;
+};
+
+static kuro::task<int> await_with_promise()
+{
+    co_return co_await promise_awaitable{};
+}
+
 TEST_CASE("task")
 {
     REQUIRE(kuro::event_loop::run(return_10()) == 10);
@@ -47,4 +69,211 @@ TEST_CASE("task")
 
     kuro::event_loop::run(modify_global_return_void());
     REQUIRE(global == 50);
+
+    REQUIRE(kuro::event_loop::run(await_with_promise()) == 1);
+}
+
+static int live_guards = 0;
+
+struct guard
+{
+    guard() { ++live_guards; }
+    ~guard() { --live_guards; }
+};
+
+static kuro::task<int> slow_leaf()
+{
+    guard g;
+    co_await kuro::sleep_for(std::chrono::seconds(10));
+    co_return 1;
+}
+
+static kuro::task<int> slow_handler()
+{
+    guard g;
+    co_return co_await slow_leaf() + 1;
+}
+
+static kuro::task<int> self_cancelling(kuro::cancellation& cancel)
+{
+    guard g;
+    cancel.trigger();
+    co_await kuro::sleep_for(std::chrono::milliseconds(1));
+    co_return 1;
+}
+
+static std::atomic<int> chunks_started = 0;
+static std::atomic<int> chunks_finished = 0;
+
+static kuro::task<void> blocking_handler()
+{
+    guard g;
+    std::vector<int> items{1, 2};
+    co_await kuro::parallel_for(items, 1, [](int) {
+        ++chunks_started;
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        ++chunks_finished;
+    });
+}
+
+// Catches the task_cancelled thrown once the chunks are done, so it isn't
+// cancelled after all.
+static kuro::task<int> recovering_handler()
+{
+    try {
+        co_await blocking_handler();
+    } catch (const kuro::task_cancelled&) {}
+    co_return 2;
+}
+
+static int cleanups = 0;
+
+// The sleep is cancelled at once, and the frame still unwinds through the
+// catch block.
+static kuro::task<int> cleaning_handler()
+{
+    try {
+        co_await kuro::sleep_for(std::chrono::seconds(10));
+    } catch (const kuro::task_cancelled&) {
+        ++cleanups;
+        throw;
+    }
+    co_return 1;
+}
+
+static kuro::task<std::vector<int>> cancel_tasks()
+{
+    std::vector<int> live;
+    auto timed_out = co_await kuro::with_timeout(slow_handler(), std::chrono::milliseconds(5));
+    live.push_back(timed_out.has_value() + live_guards);
+
+    kuro::cancellation cancel;
+    auto cancelled = co_await kuro::with_cancellation(self_cancelling(cancel), cancel);
+    live.push_back(cancelled.has_value() + live_guards);
+
+    // The timeout can't interrupt a running chunk, so it waits for the
+    // handler to unwind.
+    auto blocked = co_await kuro::with_timeout(blocking_handler(), std::chrono::milliseconds(1));
+    live.push_back(blocked.has_value() + live_guards);
+    live.push_back(chunks_started == chunks_finished);
+
+    auto recovered = co_await kuro::with_timeout(recovering_handler(), std::chrono::milliseconds(1));
+    live.push_back(recovered.value_or(-1));
+
+    auto cleaned = co_await kuro::with_timeout(cleaning_handler(), std::chrono::milliseconds(1));
+    live.push_back(cleaned.has_value() + cleanups);
+    co_return live;
+}
+
+TEST_CASE("task_cancellation")
+{
+    REQUIRE(kuro::event_loop::run(cancel_tasks()) == std::vector<int>{0, 0, 0, 1, 2, 1});
+}
+
+static kuro::task<int> wait_forever(kuro::queue<int>& q)
+{
+    co_return co_await q.pop();
+}
+
+static kuro::task<int> nested_wait(kuro::queue<int>& q)
+{
+    co_return co_await wait_forever(q);
+}
+
+static kuro::task<int> short_sleep()
+{
+    co_await kuro::sleep_for(std::chrono::milliseconds(1));
+    co_return 1;
+}
+
+// Records whether it was started.
+class observed_sleep : public kuro::sleep_for
+{
+public:
+    observed_sleep(std::chrono::milliseconds d, bool& started) : kuro::sleep_for(d), m_started(started) {}
+    void await_suspend(std::coroutine_handle<> handle)
+    {
+        m_started = true;
+        kuro::sleep_for::await_suspend(handle);
+    }
+
+private:
+    bool& m_started;
+};
+
+static kuro::task<int> long_sleep(bool& started)
+{
+    co_await observed_sleep(std::chrono::seconds(10), started);
+    co_return 1;
+}
+
+template <typename T>
+static kuro::task<bool> expect_deadline(kuro::task<T> t)
+{
+    try {
+        co_await std::move(t);
+    } catch (const kuro::deadline_exceeded&) {
+        co_return true;
+    }
+    co_return false;
+}
+
+static kuro::task<std::vector<int>> propagate_deadlines()
+{
+    std::vector<int> exceeded;
+    kuro::queue<int> q;
+
+    exceeded.push_back(co_await expect_deadline(nested_wait(q).with_deadline(std::chrono::milliseconds(10))));
+
+    // A sleep that ends after the deadline fails before it is started.
+    bool started = false;
+    bool slept = co_await expect_deadline(long_sleep(started).with_deadline(std::chrono::seconds(5)));
+    exceeded.push_back(slept && !started);
+
+    exceeded.push_back(co_await expect_deadline(short_sleep().with_deadline(std::chrono::seconds(1))));
+
+    auto timed_out = co_await kuro::with_timeout(
+        nested_wait(q).with_deadline(std::chrono::seconds(10)), std::chrono::milliseconds(1));
+    exceeded.push_back(timed_out.has_value());
+    co_return exceeded;
+}
+
+TEST_CASE("task_deadline")
+{
+    REQUIRE(kuro::event_loop::run(propagate_deadlines()) == std::vector<int>{1, 1, 0, 0});
+}
+
+static int eager_steps = 0;
+
+static kuro::eager_task<int> eager_sync()
+{
+    ++eager_steps;
+    co_return 1;
+}
+
+static kuro::eager_task<int> eager_suspending()
+{
+    ++eager_steps;
+    co_await kuro::sleep_for(std::chrono::milliseconds(1));
+    co_return 2;
+}
+
+static kuro::task<std::vector<int>> await_eager()
+{
+    std::vector<int> seen;
+    auto sync = eager_sync();
+    seen.push_back(eager_steps);
+    seen.push_back(sync.done());
+    seen.push_back(co_await sync);
+
+    auto suspending = eager_suspending();
+    seen.push_back(eager_steps);
+    seen.push_back(suspending.done());
+    seen.push_back(co_await suspending);
+    co_return seen;
+}
+
+TEST_CASE("eager_task")
+{
+    REQUIRE(kuro::event_loop::run(await_eager()) == std::vector<int>{1, 1, 1, 2, 0, 2});
 }
\ No newline at end of file
@@ -0,0 +1,158 @@
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "catch.hpp"
+#include "kuro/kuro.hpp"
+
+struct counters
+{
+    int in_flight = 0;
+    int max_in_flight = 0;
+    int finished = 0;
+    int destroyed = 0;
+};
+
+struct destroy_guard
+{
+    ~destroy_guard()
+    {
+        ++c.destroyed;
+    }
+
+    counters& c;
+};
+
+static kuro::task<void> worker(counters& c, std::chrono::milliseconds delay)
+{
+    destroy_guard guard{c};
+    ++c.in_flight;
+    c.max_in_flight = std::max(c.max_in_flight, c.in_flight);
+    co_await kuro::sleep_for(delay);
+    --c.in_flight;
+    ++c.finished;
+}
+
+static kuro::task<void> failing_worker()
+{
+    co_await kuro::sleep_for(std::chrono::milliseconds(1));
+    throw std::runtime_error("failed");
+}
+
+static kuro::task<counters> bounded()
+{
+    counters c;
+    kuro::task_group group(2);
+    for (int i = 0; i < 10; ++i) {
+        co_await group.spawn(worker(c, std::chrono::milliseconds(1)));
+    }
+    co_await group.join();
+    co_return c;
+}
+
+static kuro::task<std::pair<bool, counters>> first_failure()
+{
+    counters c;
+    bool thrown = false;
+    kuro::task_group group;
+    co_await group.spawn(worker(c, std::chrono::seconds(10)));
+    co_await group.spawn(failing_worker());
+    co_await group.spawn(worker(c, std::chrono::seconds(10)));
+    try {
+        co_await group.join();
+    } catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    try {
+        co_await group.spawn(worker(c, std::chrono::milliseconds(1)));
+        thrown = false;
+    } catch (const std::runtime_error&) {}
+    co_return {thrown && group.size() == 0, c};
+}
+
+static kuro::task<counters> cancel_on_destruction()
+{
+    counters c;
+    {
+        kuro::task_group group;
+        co_await group.spawn(worker(c, std::chrono::seconds(10)));
+        co_await group.spawn(worker(c, std::chrono::seconds(10)));
+    }
+    co_return c;
+}
+
+static kuro::task<void> offload(bool& finished)
+{
+    co_await kuro::run_in_executor([] { std::this_thread::sleep_for(std::chrono::milliseconds(20)); });
+    finished = true;
+}
+
+// The offloaded call has started by the time the group is cancelled, so the
+// child can't be cancelled at once and join waits for it.
+static kuro::task<bool> join_uncancellable()
+{
+    bool finished = false;
+    kuro::task_group group;
+    co_await group.spawn(offload(finished));
+    co_await kuro::sleep_for(std::chrono::milliseconds(5));
+    group.cancel();
+    co_await group.join();
+    co_return finished && group.size() == 0;
+}
+
+static kuro::task<void> spawn_and_join(bool& finished)
+{
+    kuro::task_group group;
+    co_await group.spawn(offload(finished));
+    co_await group.join();
+}
+
+// Timing out the owner while it joins cancels the group, and the owner only
+// unwinds once the child whose offloaded call had started is done.
+static kuro::task<bool> cancel_join()
+{
+    bool finished = false;
+    auto joined = co_await kuro::with_timeout(spawn_and_join(finished), std::chrono::milliseconds(5));
+    co_return !joined && finished;
+}
+
+static kuro::task<void> schedule_after_yield(std::vector<int>& order)
+{
+    co_await kuro::yield();
+    kuro::event_loop::call_soon([&order] { order.push_back(2); });
+}
+
+// The child's completion resumes the lone joiner by symmetric transfer,
+// ahead of the callback it queued.
+static kuro::task<std::vector<int>> join_by_transfer()
+{
+    std::vector<int> order;
+    kuro::task_group group;
+    co_await group.spawn(schedule_after_yield(order));
+    co_await group.join();
+    order.push_back(1);
+    co_await kuro::yield();
+    co_return order;
+}
+
+TEST_CASE("task_group")
+{
+    auto c = kuro::event_loop::run(bounded());
+    REQUIRE(c.max_in_flight == 2);
+    REQUIRE(c.finished == 10);
+    REQUIRE(c.destroyed == 10);
+
+    auto [thrown, failed] = kuro::event_loop::run(first_failure());
+    REQUIRE(thrown);
+    REQUIRE(failed.finished == 0);
+    REQUIRE(failed.destroyed == 2);
+
+    auto cancelled = kuro::event_loop::run(cancel_on_destruction());
+    REQUIRE(cancelled.finished == 0);
+    REQUIRE(cancelled.destroyed == 2);
+
+    REQUIRE(kuro::event_loop::run(join_uncancellable()));
+    REQUIRE(kuro::event_loop::run(cancel_join()));
+
+    REQUIRE(kuro::event_loop::run(join_by_transfer()) == std::vector<int>{1, 2});
+}
\ No newline at end of file
@@ -1,3 +1,7 @@
+#include <memory>
+#include <thread>
+#include <vector>
+
 #include "catch.hpp"
 #include "kuro/kuro.hpp"
 
@@ -19,10 +23,122 @@ static kuro::task<std::pair<std::optional<int>, std::optional<int>>> read_queue(
     co_return {first_attempt, second_attempt};
 }
 
+static kuro::task<std::pair<int, std::uint64_t>> pops_without_frames()
+{
+    kuro::queue<int> q;
+    kuro::cancellation never;
+    auto frames = [] {
+        auto stats = kuro::frame_allocator::stats();
+        return stats.hits + stats.misses;
+    };
+
+    int sum = 0;
+    auto before = frames();
+    for (int i = 0; i < 100; ++i) {
+        kuro::event_loop::call_soon([&q, i] { q.push(i); });
+        auto cancellable = co_await kuro::with_cancellation(q.pop(), never);
+        kuro::event_loop::call_soon([&q, i] { q.push(i); });
+        auto timed = co_await kuro::with_timeout(q.pop(), std::chrono::seconds(1));
+        sum += *cancellable + *timed;
+    }
+    co_return {sum, frames() - before};
+}
+
 TEST_CASE("with_cancellation")
 {
     auto read_attempts = kuro::event_loop::run(read_queue());
     REQUIRE(!read_attempts.first);
     REQUIRE(read_attempts.second);
     REQUIRE(*read_attempts.second == 10);
+}
+
+TEST_CASE("with_cancellation_frames")
+{
+    REQUIRE(kuro::event_loop::run(pops_without_frames()) == std::pair<int, std::uint64_t>{9900, 0});
+}
+
+static kuro::task<int> cancel_subtree()
+{
+    kuro::cancellation server;
+    auto connection = server.child();
+    auto request = connection.child();
+    auto idle = server.child();
+    auto finished = server.child();
+    finished.trigger();
+
+    std::vector<std::unique_ptr<kuro::cancellation>> chain;
+    chain.emplace_back(new kuro::cancellation(request.child()));
+    for (int i = 0; i < 10000; ++i) {
+        chain.emplace_back(new kuro::cancellation(chain.back()->child()));
+    }
+
+    kuro::queue<int> q;
+    int woken = 0;
+    auto wait_on = [](kuro::queue<int>& q, kuro::cancellation& c, int& n) -> kuro::shared_task<void> {
+        auto value = co_await kuro::with_cancellation(q.pop(), c);
+        if (!value) {
+            ++n;
+        }
+    };
+    std::vector<kuro::shared_task<void>> waiters;
+    for (int i = 0; i < 100; ++i) {
+        waiters.push_back(kuro::event_loop::create_task(wait_on(q, connection, woken)));
+        waiters.push_back(kuro::event_loop::create_task(wait_on(q, request, woken)));
+        waiters.push_back(kuro::event_loop::create_task(wait_on(q, *chain.back(), woken)));
+    }
+    co_await kuro::sleep_for(std::chrono::milliseconds(1));
+
+    server.trigger();
+    for (auto& w : waiters) {
+        co_await w;
+    }
+    while (!chain.empty()) {
+        chain.pop_back();
+    }
+    co_return woken + idle.is_set();
+}
+
+// One trigger wakes both waits, so the losing one is cancelled while it is
+// in the ready queue, and must not resume its racer after the race is over.
+static kuro::task<bool> race_woken_waits()
+{
+    kuro::cancellation parent;
+    auto a = parent.child();
+    auto b = parent.child();
+    kuro::event_loop::call_soon([&] { parent.trigger(); });
+    co_await kuro::when_any(a.wait(), b.wait());
+    co_await kuro::yield();
+    co_return a.is_set() && b.is_set();
+}
+
+TEST_CASE("cancellation_hierarchy")
+{
+    REQUIRE(kuro::event_loop::run(cancel_subtree()) == 301);
+    REQUIRE(kuro::event_loop::run(race_woken_waits()));
+}
+
+static kuro::task<std::optional<int>> pop_until(kuro::queue<int>& q, kuro::cancellation& c)
+{
+    co_return co_await kuro::with_cancellation(q.pop(), c);
+}
+
+static kuro::task<std::optional<int>> trigger_then_destroy()
+{
+    kuro::queue<int> q;
+    auto c = std::make_unique<kuro::cancellation>();
+    auto waiter = kuro::event_loop::create_task(pop_until(q, *c));
+    co_await kuro::sleep_for(std::chrono::milliseconds(1));
+    q.push(1);
+    auto value = co_await waiter;
+
+    // The wakeup posted by trigger runs after the cancellation is gone.
+    std::thread([&] { c->trigger(); }).join();
+    c.reset();
+    co_await kuro::sleep_for(std::chrono::milliseconds(1));
+    co_return value;
+}
+
+TEST_CASE("cancellation_trigger_threadsafe")
+{
+    REQUIRE(kuro::event_loop::run(trigger_then_destroy()) == 1);
 }
\ No newline at end of file
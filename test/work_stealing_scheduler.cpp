@@ -0,0 +1,68 @@
+#include <atomic>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "catch.hpp"
+#include "kuro/kuro.hpp"
+
+template <typename T>
+using worker_task = kuro::work_stealing_scheduler::worker_task<T>;
+
+static worker_task<std::uint64_t> fib(kuro::work_stealing_scheduler& scheduler, int n)
+{
+    if (n < 2) {
+        co_return n;
+    }
+
+    auto a = scheduler.create_task(fib(scheduler, n - 1));
+    auto b = co_await fib(scheduler, n - 2);
+    co_return co_await a + b;
+}
+
+static worker_task<void> fail(kuro::work_stealing_scheduler& scheduler)
+{
+    co_await scheduler.schedule();
+    throw std::runtime_error("failed");
+}
+
+TEST_CASE("work_stealing_scheduler")
+{
+    kuro::work_stealing_scheduler scheduler(4);
+    REQUIRE(scheduler.run(fib(scheduler, 20)) == 6765);
+    REQUIRE_THROWS_AS(scheduler.run(fail(scheduler)), std::runtime_error);
+    static_assert(kuro::detail::worker_only<kuro::work_stealing_scheduler::forked_task<int>>);
+    static_assert(kuro::detail::worker_only<worker_task<int>>);
+    static_assert(!kuro::detail::worker_only<kuro::task<int>>);
+
+    kuro::detail::chase_lev_deque<int> deque(2);
+    constexpr int n_items = 100000;
+    std::atomic<long> stolen_sum = 0;
+    std::atomic<bool> done = false;
+    std::vector<std::jthread> thieves;
+    for (int i = 0; i < 3; ++i) {
+        thieves.emplace_back([&] {
+            while (!done || !deque.empty()) {
+                if (auto item = deque.steal()) {
+                    stolen_sum += *item;
+                }
+            }
+        });
+    }
+
+    long popped_sum = 0;
+    for (int i = 1; i <= n_items; ++i) {
+        deque.push(i);
+        if (i % 3 == 0) {
+            if (auto item = deque.pop()) {
+                popped_sum += *item;
+            }
+        }
+    }
+    while (auto item = deque.pop()) {
+        popped_sum += *item;
+    }
+    done = true;
+    thieves.clear();
+    REQUIRE(popped_sum + stolen_sum == long(n_items) * (n_items + 1) / 2);
+}
\ No newline at end of file